@@ -0,0 +1,208 @@
+// Codec for the engine's binary API mode (`dsa2 --api=binary`).
+// Frame layouts are documented in the BINARY PROTOCOL section of dsa2.c.
+
+const OP = { ADD: 1, UPDATE: 2, UPDATEBATCH: 3, STOCKS: 4, SUMMARY: 5, TOP: 6, HELLO: 7, TEXT: 0x7f };
+const RESP = { OK: 0, ERROR: 1, STOCKS: 2, SUMMARY: 3, TOP: 4, JSON: 5, HELLO: 6 };
+
+// Must match PROTOCOL_VERSION and PRICE_SCALE in dsa2.c; HELLO checks both
+const PROTOCOL_VERSION = 2;
+const PRICE_SCALE = 10000;
+const PRICE_DECIMALS = 4;
+const PRICE_MAX = 2n ** 53n;
+const BAD_PRICE = -(2n ** 63n); // Out of range, so the engine rejects it
+
+const NAME_LEN = 20;
+const TICK_RECORD_SIZE = 32;
+const STOCK_RECORD_SIZE = 68;
+
+const OK_MESSAGES = {
+    [OP.ADD]: 'Stock Added',
+    [OP.UPDATE]: 'Price Updated',
+    [OP.UPDATEBATCH]: 'Batch Applied',
+};
+
+// Text responses print gains and indicators like %.2f: nearest, exact ties to even
+function round2(x) {
+    const scaled = Math.abs(x) * 100;
+    let r = Math.round(scaled);
+    if (r - scaled === 0.5 && r % 2) r -= 1;
+    return (Math.sign(x) * r) / 100;
+}
+
+// Leading decimal number to ticks, rounded half away from zero like the
+// engine's text parser (priceParse), so both links store the same price.
+// Only exponent forms go through floating point.
+function toTicks(price) {
+    const text = String(price ?? '').trimStart();
+    const m = /^([+-]?)(\d*)(?:\.(\d*))?([eE])?/.exec(text);
+    if (!m[2] && !m[3]) return BAD_PRICE;
+    let ticks;
+    if (m[4]) {
+        const n = parseFloat(text);
+        if (!(Math.abs(n) * PRICE_SCALE <= Number(PRICE_MAX))) return BAD_PRICE;
+        ticks = BigInt(Math.sign(n) * Math.round(Math.abs(n) * PRICE_SCALE));
+    } else {
+        const frac = (m[3] || '').padEnd(PRICE_DECIMALS + 1, '0');
+        ticks = BigInt((m[2] || '0') + frac.slice(0, PRICE_DECIMALS)) + (frac[PRICE_DECIMALS] >= '5' ? 1n : 0n);
+        if (m[1] === '-') ticks = -ticks;
+    }
+    return ticks < -PRICE_MAX || ticks > PRICE_MAX ? BAD_PRICE : ticks;
+}
+
+// Ticks to rupees at two decimals, half away from zero, the way text
+// responses print them
+function fromTicks(ticks) {
+    const perPaisa = BigInt(PRICE_SCALE / 100);
+    const abs = ticks < 0n ? -ticks : ticks;
+    const paisa = Number((abs + perPaisa / 2n) / perPaisa);
+    return (ticks < 0n ? -paisa : paisa) / 100;
+}
+
+// Request: u32 length | u32 requestId | u8 opcode | payload
+function frame(op, id, payload = Buffer.alloc(0)) {
+    const buf = Buffer.alloc(9 + payload.length);
+    buf.writeUInt32LE(5 + payload.length, 0);
+    buf.writeUInt32LE(id, 4);
+    buf.writeUInt8(op, 8);
+    payload.copy(buf, 9);
+    return buf;
+}
+
+// Symbols that do not fit the fixed-width field are sent as an empty name,
+// which the engine rejects instead of silently matching a truncated symbol.
+function writeTick(buf, offset, name, price, qty) {
+    if (name && Buffer.byteLength(name, 'utf8') < NAME_LEN) buf.write(name, offset, 'utf8');
+    buf.writeBigInt64LE(toTicks(price), offset + NAME_LEN);
+    buf.writeInt32LE(Number.isFinite(qty) ? qty : -1, offset + NAME_LEN + 8);
+}
+
+function tickFrame(op, id, name, price, qty) {
+    const payload = Buffer.alloc(TICK_RECORD_SIZE);
+    writeTick(payload, 0, name, price, qty);
+    return frame(op, id, payload);
+}
+
+// Translate a text command (as built by server.js) into a request frame
+// tagged with 'id'. Returns { op, frame }; anything without a binary layout
+// goes through TEXT.
+function encodeCommand(cmd, id) {
+    const [head, ...body] = cmd.split('\n');
+    const parts = head.trim().split(/\s+/);
+
+    switch (parts[0]) {
+        case 'ADD':
+            return { op: OP.ADD, frame: tickFrame(OP.ADD, id, parts[1], parts[2], parseInt(parts[3], 10)) };
+        case 'UPDATE':
+            return { op: OP.UPDATE, frame: tickFrame(OP.UPDATE, id, parts[1], parts[2], parseInt(parts[3], 10)) };
+        case 'UPDATEBATCH': {
+            const payload = Buffer.alloc(4 + body.length * TICK_RECORD_SIZE);
+            payload.writeUInt32LE(body.length, 0);
+            body.forEach((line, i) => {
+                const [name, price, qty] = line.trim().split(/\s+/);
+                writeTick(payload, 4 + i * TICK_RECORD_SIZE, name, price, parseInt(qty, 10));
+            });
+            return { op: OP.UPDATEBATCH, frame: frame(OP.UPDATEBATCH, id, payload) };
+        }
+        case 'STOCKS':
+            return { op: OP.STOCKS, frame: frame(OP.STOCKS, id) };
+        case 'SUMMARY':
+            return { op: OP.SUMMARY, frame: frame(OP.SUMMARY, id) };
+        case 'TOP':
+            return { op: OP.TOP, frame: frame(OP.TOP, id) };
+        case 'HELLO': {
+            const payload = Buffer.alloc(4);
+            payload.writeUInt32LE(PROTOCOL_VERSION, 0);
+            return { op: OP.HELLO, frame: frame(OP.HELLO, id, payload) };
+        }
+        default:
+            return { op: OP.TEXT, frame: frame(OP.TEXT, id, Buffer.from(head, 'utf8')) };
+    }
+}
+
+// Accumulates stdout chunks and yields complete frame bodies
+// (requestId + type + payload)
+class FrameReader {
+    constructor() {
+        this.buffer = Buffer.alloc(0);
+    }
+
+    push(chunk) {
+        this.buffer = this.buffer.length ? Buffer.concat([this.buffer, chunk]) : chunk;
+        const frames = [];
+        while (this.buffer.length >= 4) {
+            const len = this.buffer.readUInt32LE(0);
+            if (this.buffer.length < 4 + len) break;
+            frames.push(this.buffer.subarray(4, 4 + len));
+            this.buffer = this.buffer.subarray(4 + len);
+        }
+        return frames;
+    }
+}
+
+function decodeStock(buf, offset) {
+    const raw = buf.toString('latin1', offset, offset + NAME_LEN);
+    const nul = raw.indexOf('\0');
+    let o = offset + NAME_LEN;
+    const f32 = () => { const v = round2(buf.readFloatLE(o)); o += 4; return v; };
+    const i64 = () => { const v = fromTicks(buf.readBigInt64LE(o)); o += 8; return v; };
+    const stock = { name: nul === -1 ? raw : raw.slice(0, nul) };
+    stock.buyPrice = i64();
+    stock.currentPrice = i64();
+    stock.quantity = buf.readInt32LE(o); o += 4;
+    stock.percentGain = f32();
+    stock.sma = f32();
+    stock.rsi = f32();
+    stock.upperAlert = i64();
+    stock.lowerAlert = i64();
+    return stock;
+}
+
+const responseId = (body) => body.readUInt32LE(0);
+
+// STOCKS, SUMMARY and TOP are served from a snapshot and lead with its version
+const SNAPSHOT_TYPES = new Set([RESP.STOCKS, RESP.SUMMARY, RESP.TOP]);
+const responseVersion = (body) =>
+    SNAPSHOT_TYPES.has(body.readUInt8(4)) ? Number(body.readBigUInt64LE(5)) : undefined;
+
+// Turn a response frame into the same object shape the text protocol yields
+function decodeResponse(body, op) {
+    const type = body.readUInt8(4);
+    const p = body.subarray(5);
+
+    switch (type) {
+        case RESP.OK: {
+            const result = { status: 'ok', message: OK_MESSAGES[op] || 'OK' };
+            if (op === OP.UPDATEBATCH) {
+                result.applied = p.readUInt32LE(0);
+                result.rejected = p.readUInt32LE(4);
+            }
+            return result;
+        }
+        case RESP.ERROR:
+            return { error: p.toString('utf8') };
+        case RESP.STOCKS: {
+            const count = p.readUInt32LE(8);
+            const stocks = [];
+            for (let i = 0; i < count; i++) stocks.push(decodeStock(p, 12 + i * STOCK_RECORD_SIZE));
+            return stocks;
+        }
+        case RESP.SUMMARY:
+            return {
+                totalInvestment: fromTicks(p.readBigInt64LE(8)),
+                currentValue: fromTicks(p.readBigInt64LE(16)),
+                profit: fromTicks(p.readBigInt64LE(24)),
+                stockCount: p.readUInt32LE(32),
+            };
+        case RESP.TOP:
+            if (!p.readUInt8(8)) return { topGainer: null, topLoser: null };
+            return { topGainer: decodeStock(p, 9), topLoser: decodeStock(p, 9 + STOCK_RECORD_SIZE) };
+        case RESP.JSON:
+            return JSON.parse(p.toString('utf8'));
+        case RESP.HELLO:
+            return { protocol: p.readUInt32LE(0), priceScale: p.readUInt32LE(4) };
+        default:
+            return { error: `Unknown response type ${type}` };
+    }
+}
+
+module.exports = { OP, RESP, PROTOCOL_VERSION, PRICE_SCALE, encodeCommand, decodeResponse, responseId, responseVersion, FrameReader };
@@ -3,6 +3,7 @@ const { spawn } = require('child_process');
 const bodyParser = require('body-parser');
 const cors = require('cors');
 const path = require('path');
+const binaryProtocol = require('./binaryProtocol');
 
 const app = express();
 const PORT = 5000;
@@ -13,53 +14,112 @@ app.use(bodyParser.json());
 const dsaExecutable = process.platform === 'win32' ? 'dsa2.exe' : 'dsa2';
 const dsaPath = path.join(__dirname, '..', dsaExecutable);
 
+// DSA_PROTOCOL=binary switches the engine link to length-prefixed frames;
+// the default text protocol stays available for debugging.
+const useBinary = process.env.DSA_PROTOCOL === 'binary';
+
+// DSA_SHARDS=N splits the engine's symbols over N worker threads.
+// DSA_DATA_DIR keeps the engine's state on disk, so a respawned engine
+// comes back with every stock, history and transaction it had.
+const engineArgs = [useBinary ? '--api=binary' : '--api'];
+if (process.env.DSA_SHARDS) engineArgs.push(`--shards=${process.env.DSA_SHARDS}`);
+if (process.env.DSA_DATA_DIR) engineArgs.push(`--data-dir=${process.env.DSA_DATA_DIR}`);
+
 // --- RESILIENT COMMUNICATION LAYER ---
-let isCProcessing = false;
+// Every command is tagged with a request ID, so many commands can be in
+// flight at once and responses are matched back to their promises by ID
+// instead of by arrival order. Commands beyond MAX_IN_FLIGHT wait in
+// commandQueue until a slot frees up.
+const MAX_IN_FLIGHT = 256;
+let nextRequestId = 1;
+let pending = new Map(); // requestId -> { resolve, reject, op, withVersion }
 let commandQueue = [];
+let engineReady = false;
 let dataBuffer = '';
-let responseQueue = [];
+let frameReader = new binaryProtocol.FrameReader();
+
+// 'version' is the engine snapshot a STOCKS/SUMMARY/TOP response reflects
+function settle(id, decode, version) {
+    const entry = pending.get(id);
+    if (!entry) {
+        console.error(`Response for unknown request ${id}`);
+        return;
+    }
+    pending.delete(id);
+    const data = decode(entry.op);
+    entry.resolve(entry.withVersion ? { data, version } : data);
+    processQueue();
+}
+
+// The binary link carries fixed-point ticks, so the engine must agree on both
+// the frame layout and the price scale before anything else is sent
+function checkHandshake(reply) {
+    if (reply.protocol === binaryProtocol.PROTOCOL_VERSION && reply.priceScale === binaryProtocol.PRICE_SCALE) return;
+    console.error('Engine binary protocol mismatch:', reply);
+    process.exit(1);
+}
 
 function spawnCProcess() {
-    console.log(`Spawning C process at: ${dsaPath}`);
-    const process = spawn(dsaPath, ['--api']);
+    console.log(`Spawning C process at: ${dsaPath} (${useBinary ? 'binary' : 'text'} protocol)`);
+    const process = spawn(dsaPath, engineArgs);
+    dataBuffer = '';
+    frameReader = new binaryProtocol.FrameReader();
+    engineReady = true;
+    if (useBinary) commandQueue.unshift({ cmd: 'HELLO', resolve: checkHandshake, reject: () => {}, withVersion: false });
 
     process.on('error', (err) => {
         console.error('Failed to start C process:', err);
     });
 
+    process.stdin.on('error', (err) => {
+        console.error('Failed to write to C stdin:', err);
+    });
+
     process.on('close', (code) => {
         console.log(`C process exited with code ${code}. Restarting...`);
-        // Clear queue on crash to avoid hanging requests
-        while (responseQueue.length > 0) {
-            const { reject } = responseQueue.shift();
-            reject(new Error('C process crashed'));
-        }
-        isCProcessing = false;
-        setTimeout(() => { dsaProcess = spawnCProcess(); }, 1000);
+        engineReady = false;
+        // Fail in-flight requests on crash to avoid hanging them; queued ones
+        // are sent to the restarted process.
+        for (const { reject } of pending.values()) reject(new Error('C process crashed'));
+        pending.clear();
+        setTimeout(() => {
+            dsaProcess = spawnCProcess();
+            processQueue();
+        }, 1000);
     });
 
     process.stdout.on('data', (data) => {
+        if (useBinary) {
+            for (const frame of frameReader.push(data)) {
+                settle(binaryProtocol.responseId(frame), (op) => binaryProtocol.decodeResponse(frame, op),
+                    binaryProtocol.responseVersion(frame));
+            }
+            return;
+        }
+
         dataBuffer += data.toString();
         let newlineIdx;
         while ((newlineIdx = dataBuffer.indexOf('\n')) !== -1) {
             const line = dataBuffer.substring(0, newlineIdx).trim();
             dataBuffer = dataBuffer.substring(newlineIdx + 1);
 
-            if (line) {
-                console.log(`[C OUTPUT]: ${line}`);
-                if (responseQueue.length > 0) {
-                    const { resolve } = responseQueue.shift();
-                    try {
-                        const json = JSON.parse(line);
-                        resolve(json);
-                    } catch (e) {
-                        console.error('Failed to parse JSON:', e, 'Line:', line);
-                        resolve({ error: 'Invalid JSON from C backend', raw: line });
-                    }
-                }
-                isCProcessing = false;
-                processNextCommand();
+            // Tagged response: "#<id> <json>", or "#<id>@<version> <json>"
+            // for reads served from a snapshot
+            const space = line.indexOf(' ');
+            if (!line.startsWith('#') || space === -1) {
+                if (line) console.error('Untagged line from C backend:', line);
+                continue;
             }
+            const [id, version] = line.substring(1, space).split('@').map(Number);
+            const payload = line.substring(space + 1);
+            settle(id, () => {
+                try {
+                    return JSON.parse(payload);
+                } catch (e) {
+                    console.error('Failed to parse JSON:', e, 'Line:', line);
+                    return { error: 'Invalid JSON from C backend', raw: payload };
+                }
+            }, version);
         }
     });
 
@@ -72,36 +132,51 @@ function spawnCProcess() {
 
 let dsaProcess = spawnCProcess();
 
-function processNextCommand() {
-    if (isCProcessing || commandQueue.length === 0) return;
-
-    isCProcessing = true;
-    const { cmd, resolve, reject } = commandQueue.shift();
-    responseQueue.push({ resolve, reject });
+function dispatch({ cmd, resolve, reject, withVersion }) {
+    const id = nextRequestId;
+    nextRequestId = nextRequestId >= 0xffffffff ? 1 : nextRequestId + 1;
 
     try {
-        console.log(`[SENDING CMD]: ${cmd}`);
-        dsaProcess.stdin.write(cmd + '\n');
+        if (useBinary) {
+            const { op, frame } = binaryProtocol.encodeCommand(cmd, id);
+            pending.set(id, { resolve, reject, op, withVersion });
+            dsaProcess.stdin.write(frame);
+        } else {
+            // The tag goes on the first line; UPDATEBATCH bodies follow as-is
+            pending.set(id, { resolve, reject, withVersion });
+            dsaProcess.stdin.write(`#${id} ${cmd}\n`);
+        }
     } catch (e) {
         console.error('Failed to write to C stdin:', e);
-        const { reject } = responseQueue.shift();
+        pending.delete(id);
         reject(e);
-        isCProcessing = false;
     }
 }
 
-function sendCommand(cmd) {
+function processQueue() {
+    while (engineReady && pending.size < MAX_IN_FLIGHT && commandQueue.length > 0) {
+        dispatch(commandQueue.shift());
+    }
+}
+
+function sendCommand(cmd, withVersion = false) {
     return new Promise((resolve, reject) => {
-        commandQueue.push({ cmd, resolve, reject });
-        processNextCommand();
+        commandQueue.push({ cmd, resolve, reject, withVersion });
+        processQueue();
     });
 }
 
+// Reads served from an engine snapshot report its version in a header
+async function sendSnapshotRead(res, cmd) {
+    const { data, version } = await sendCommand(cmd, true);
+    if (Number.isFinite(version)) res.set('X-Snapshot-Version', String(version));
+    res.json(data);
+}
+
 // --- API ENDPOINTS ---
 
 app.get('/api/stocks', async (req, res) => {
-    const data = await sendCommand('STOCKS');
-    res.json(data);
+    await sendSnapshotRead(res, 'STOCKS');
 });
 
 app.post('/api/stocks', async (req, res) => {
@@ -122,21 +197,83 @@ app.post('/api/price', async (req, res) => {
     res.json(data);
 });
 
-app.get('/api/summary', async (req, res) => {
-    const data = await sendCommand('SUMMARY');
+// Ranked views served by the engine's gain-ordered tree (no client sorting)
+app.get('/api/sorted', async (req, res) => {
+    const data = await sendCommand('SORTED');
     res.json(data);
 });
 
-app.get('/api/top', async (req, res) => {
-    const data = await sendCommand('TOP');
+app.get('/api/topk/:n', async (req, res) => {
+    const data = await sendCommand(`TOPK ${parseInt(req.params.n, 10) || 10}`);
+    res.json(data);
+});
+
+app.get('/api/bottomk/:n', async (req, res) => {
+    const data = await sendCommand(`BOTTOMK ${parseInt(req.params.n, 10) || 10}`);
+    res.json(data);
+});
+
+// Symbol autocomplete: /api/search?q=BAJ&limit=10
+app.get('/api/search', async (req, res) => {
+    const q = String(req.query.q || '');
+    if (!q || /\s/.test(q)) return res.status(400).json({ error: 'Invalid prefix' });
+    const data = await sendCommand(`SEARCH ${q} ${parseInt(req.query.limit, 10) || 10}`);
+    res.json(data);
+});
+
+app.get('/api/rank/:name', async (req, res) => {
+    if (/\s/.test(req.params.name)) return res.status(400).json({ error: 'Invalid symbol' });
+    const data = await sendCommand(`RANK ${req.params.name}`);
     res.json(data);
 });
 
+app.get('/api/percentile/:p', async (req, res) => {
+    const p = Number(req.params.p);
+    if (!Number.isFinite(p)) return res.status(400).json({ error: 'Invalid percentile' });
+    const data = await sendCommand(`PERCENTILE ${p}`);
+    res.json(data);
+});
+
+// Bulk ticks: { "ticks": [{ "name", "newPrice", "newQty"? }, ...] }
+// Sent as one UPDATEBATCH message so the engine reorders each stock once.
+app.post('/api/prices', async (req, res) => {
+    const ticks = Array.isArray(req.body) ? req.body : req.body.ticks;
+    if (!Array.isArray(ticks) || ticks.length === 0) return res.status(400).json({ error: 'Missing ticks' });
+
+    const lines = [];
+    for (const { name, newPrice, newQty } of ticks) {
+        const price = Number(newPrice);
+        if (!name || /\s/.test(name) || !Number.isFinite(price)) {
+            return res.status(400).json({ error: `Invalid tick for ${name}` });
+        }
+        const qty = newQty !== undefined ? Number(newQty) : -1;
+        lines.push(`${name} ${price} ${qty}`);
+    }
+    const data = await sendCommand(`UPDATEBATCH ${lines.length}\n${lines.join('\n')}`);
+    res.json(data);
+});
+
+app.get('/api/summary', async (req, res) => {
+    await sendSnapshotRead(res, 'SUMMARY');
+});
+
+app.get('/api/top', async (req, res) => {
+    await sendSnapshotRead(res, 'TOP');
+});
+
 app.get('/api/trends/:name', async (req, res) => {
     const data = await sendCommand(`TRENDS ${req.params.name}`);
     res.json(data);
 });
 
+// Register an extra indicator period, e.g. { "type": "SMA", "period": 20 }
+app.post('/api/indicators', async (req, res) => {
+    const { type, period } = req.body;
+    if (!type || !period) return res.status(400).json({ error: 'Missing fields' });
+    const data = await sendCommand(`INDICATOR ${String(type).toUpperCase()} ${Number(period)}`);
+    res.json(data);
+});
+
 app.get('/api/transactions', async (req, res) => {
     const data = await sendCommand('TRANSACTIONS');
     res.json(data);
@@ -147,6 +284,39 @@ app.get('/api/clusters', async (req, res) => {
     res.json(data);
 });
 
+// Rolling return correlations (stocks need a full 100-tick window)
+app.get('/api/corr/:a/:b', async (req, res) => {
+    if (/\s/.test(req.params.a + req.params.b)) return res.status(400).json({ error: 'Invalid symbol' });
+    const data = await sendCommand(`CORR ${req.params.a} ${req.params.b}`);
+    res.json(data);
+});
+
+app.get('/api/correlations/:name', async (req, res) => {
+    if (/\s/.test(req.params.name)) return res.status(400).json({ error: 'Invalid symbol' });
+    const data = await sendCommand(`CORR_TOP ${req.params.name} ${parseInt(req.query.k, 10) || 10}`);
+    res.json(data);
+});
+
+// Edge list for the correlation graph: /api/correlations?threshold=0.8&limit=100
+app.get('/api/correlations', async (req, res) => {
+    const threshold = req.query.threshold !== undefined ? Number(req.query.threshold) : 0.8;
+    if (Number.isNaN(threshold)) return res.status(400).json({ error: 'Invalid threshold' });
+    const data = await sendCommand(`CORR_EDGES ${threshold} ${parseInt(req.query.limit, 10) || 100}`);
+    res.json(data);
+});
+
+// Engine pipeline health: ring depths and stall counters
+app.get('/api/stats', async (req, res) => {
+    const data = await sendCommand('STATS');
+    res.json(data);
+});
+
+// Start a background checkpoint (needs DSA_DATA_DIR); progress is in /api/stats
+app.post('/api/checkpoint', async (req, res) => {
+    const data = await sendCommand('CHECKPOINT');
+    res.json(data);
+});
+
 app.listen(PORT, () => {
     console.log(`Backend running on http://localhost:${PORT}`);
 });
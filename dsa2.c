@@ -1,873 +1,5390 @@
 /*
  * DSA PROJECT: Advanced Stock Management System
- * Features: hash map, circular buffer, Fenwick trees, AVL, Heaps, Trie, Graph.
+ * Features: hash map, circular buffer, prefix-sum windows, AVL,
+ *           order-statistic tree, Heaps, Trie, oversold sets, symbol shards,
+ *           persistent AVL snapshots (MVCC) for reads.
  *
- * COMPILE: gcc -Wall -Wextra -std=c11 dsa2.c -o dsa2 -lm
+ * COMPILE: gcc -Wall -Wextra -std=c11 -pthread dsa2.c -o dsa2 -lm
  * RUN CLI: ./dsa2
- * RUN API: ./dsa2 --api
+ * RUN API: ./dsa2 --api          (text lines in, JSON lines out)
+ *          ./dsa2 --api=binary   (length-prefixed frames, see BINARY PROTOCOL)
+ * BENCH:   ./dsa2 --bench [maxSymbols]
+ * SHARDS:  --shards=N with any mode splits the symbols over N worker threads
+ * LOG:     --log-retain=N (transactions) or =NMB (bytes) bounds the tick log
+ * PERSIST: --data-dir=DIR (API modes) logs every change to DIR and recovers
+ *          from it on startup; --checkpoint-every=N and
+ *          --checkpoint-interval=SEC set the checkpoint rate, CHECKPOINT
+ *          starts one now (written by a forked child in the background)
  */
 
+#define _POSIX_C_SOURCE 200809L // fsync, ftruncate, mkdir
+#define _DEFAULT_SOURCE         // MAP_ANONYMOUS, nice
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 /* --- CONFIGURATION --- */
-#define HASH_SIZE 50
+#define HASH_INIT_CAP 64    // Initial symbol table slots (power of two)
+#define HASH_MIGRATE_STEP 16 // Old slots moved per insert while resizing
 #define HISTORY_SIZE 100 // Window size for history
-#define MAX_STOCKS 100   // Max capacity
+#define INIT_STOCKS 16   // Initial registry/heap capacity (doubles on demand)
 #define NAME_LEN 20
+#define PRICE_SCALE 10000 // Ticks per rupee: prices are int64 multiples of 1/N
+#define PRICE_MAX (INT64_C(1) << 53) // Largest |price| in ticks (exact double)
+#define SYMBOL_CHUNK_BITS 10 // First symbol chunk: 1024 names, then doubling
+#define PREFIX_SLOTS (HISTORY_SIZE + 1) // Prefix sums kept per stock
+#define MAX_INDICATORS 8 // Registered indicator periods (e.g. SMA 5/20/50)
+#define MAX_SHARDS 64      // Upper bound for --shards
+#define SHARD_INLINE_TICKS 256 // Smaller batches skip the worker hand-off
+#define CMD_LINE_LEN 256        // Longest command line / inline frame payload
+#define RECORD_TICKS 8          // Batch ticks carried per ingest record
+#define INGEST_RING_SLOTS 1024  // Reader -> engine records (power of two)
+#define RESPONSE_RING_SLOTS 64  // Engine -> writer responses (power of two)
+#define RING_SPIN 128           // Polls before a stalled side goes to sleep
+#define QUERY_THREADS 2         // Threads serving snapshot reads
+#define LOG_SEGMENT_ENTRIES 4096 // Transactions per log arena segment
+#define LOG_RETAIN_DEFAULT 65536 // Transactions kept (all shards together)
+#define LOG_SLAB_SEGMENTS 4      // Log segments per slab (~400 KB)
+#define STOCK_SLAB 64            // Stocks per slab (~200 KB)
+#define SNAP_NODE_SLAB 1024      // Snapshot tree nodes per slab
+#define CHECKPOINT_EVERY 250000 // Log records between automatic checkpoints
+#define CHECKPOINT_FORMAT 7      // Bumped whenever the file layout changes
+#define CHECKPOINT_NICE 10       // Priority drop of the checkpoint child
+#define CHECKPOINT_BUFFER (1 << 20) // Write buffer of the image writer
+#define HOT_IMAGE_BYTES 24       // Hot column bytes stored per stock
+#define HEAP_ARITY 4 // Children per heap node (4 entries = 32 bytes)
+#define OVERSOLD_RSI 30 // RSI(14) below this puts a stock in a risk cluster
+#define CORR_WINDOW (HISTORY_SIZE - 1) // Returns in a correlation window
+#define CORR_STRIDE ((CORR_WINDOW + 7) / 8 * 8) // Row floats, padded to lanes
+#define CORR_TILE 64      // Rows per side of a pair tile (2 x 26 KB)
+#define CORR_EDGES_MAX 10000 // Largest CORR_TOP / CORR_EDGES result
+#define DATA_PATH_LEN 1024       // Longest --data-dir path plus file name
 
 /* --- DATA STRUCTURES --- */
 
-// 1. Transaction Linked List
+// 0. Result of mutating operations (messages are reported by the caller)
+typedef enum { ST_OK, ST_EXISTS, ST_NOT_FOUND, ST_BAD_SYMBOL, ST_NO_MEMORY } Status;
+
+// 1. Transaction Log: append-only arena segments, newest first.
+// Entries are written in place, so appending never allocates once the
+// retention limit is reached: the oldest segment is recycled instead.
+typedef enum { TX_BUY, TX_SELL, TX_UPDATE, TX_TYPES } TxType;
+
 typedef struct Transaction {
-  char type[10]; // BUY, SELL, UPDATE
-  char symbol[NAME_LEN];
-  float price;
-  struct Transaction *next;
+  unsigned long seq; // Global order across the per-shard logs
+  int64_t price;     // Ticks
+  int stock;         // Symbol id
+  uint8_t type;      // TxType
 } Transaction;
 
-// 2. Trie Node for Symbol Search
+typedef struct LogSegment {
+  struct LogSegment *older, *newer;
+  int count; // Entries used, oldest at index 0
+  Transaction entries[LOG_SEGMENT_ENTRIES];
+} LogSegment;
+
+typedef struct TransactionLog {
+  LogSegment *newest, *oldest;
+  int segments;
+  unsigned long dropped; // Entries discarded by retention
+} TransactionLog;
+
+// 2. Radix trie node for symbol search, pooled like the rank trees (the
+// root is index 0, so 0 also means "none"). Edges carry whole bytes, so
+// every symbol character is indexed. A node's label is the slice
+// name[depth - len, depth) of the stock it records; siblings are sorted
+// by their first byte.
 typedef struct TrieNode {
-  struct TrieNode *children[26];
-  bool isEndOfWord;
+  int child;     // First child
+  int next;      // Next sibling
+  int stock;     // Registry id of a symbol through this node
+  int end;       // Registry id of the symbol ending here, -1 if none
+  uint8_t depth; // Path length from the root, including this label
+  uint8_t len;   // Label length
+  char first;    // First label byte: sibling scans stay inside the pool
 } TrieNode;
 
-// 3. Stock Object
-typedef struct Stock {
-  char name[NAME_LEN];
-  float currentPrice;
-  float buyPrice;
-  int quantity;
-
-  // ALERTS
-  float upperAlert;
-  float lowerAlert;
-
-  // HISTORY & FENWICK TREES (BIT)
-  // We map a circular buffer to a linear BIT for O(log N) window sums.
-  float priceHistory[HISTORY_SIZE];
-  float bit_price[HISTORY_SIZE + 1]; // 1-based indexing for BIT
-  float bit_gain[HISTORY_SIZE + 1];
-  float bit_loss[HISTORY_SIZE + 1];
-  int head;  // Points to the NEXT index to write (Circular)
-  int count; // Number of history points filled
+// 3. Indicator Registry Entry
+typedef enum { IND_SMA, IND_RSI } IndicatorType;
+// Slots of the built-in indicators in indicatorSpecs / Stock.indicators
+enum { SLOT_SMA5, SLOT_RSI14 };
 
-  // HEAP INDICES (for O(log N) updates)
-  int maxHeapIdx;
-  int minHeapIdx;
+typedef struct IndicatorSpec {
+  IndicatorType type;
+  int period;
+} IndicatorSpec;
 
-  struct Stock *next; // For Hash Table collision
+// 3b. Stock Object: the cold per-stock state. The scalars that heaps,
+// rankings and scans read are columns of 'hot' (3c), indexed by id.
+typedef struct Stock {
+  int id;          // Symbol id: index in stockRegistry and the hot columns
+  int rankIdx;     // Node in its shard's rankPool (gain-ranked tree)
+  int oversoldIdx; // Position in its shard's oversold set, -1 if not in it
+  bool inBatch;         // Already queued for end-of-batch reordering
+  bool snapDirty;       // Changed since the last published snapshot
+  bool indicatorsStale; // Ticked since indicators were refreshed
+
+  // ALERTS (ticks)
+  int64_t upperAlert;
+  int64_t lowerAlert;
+
+  // HISTORY & WINDOW PREFIX SUMS
+  // Running sums of price/gain/loss in ticks, indexed by tick number %
+  // PREFIX_SLOTS, so any trailing window of 1..HISTORY_SIZE ticks is one
+  // subtraction. They wrap modulo 2^64, which leaves every difference exact.
+  int64_t priceHistory[HISTORY_SIZE];
+  uint64_t cumPrice[PREFIX_SLOTS];
+  uint64_t cumGain[PREFIX_SLOTS];
+  uint64_t cumLoss[PREFIX_SLOTS];
+  long ticks; // Total ticks recorded (prefix index of the newest tick)
+  int head;   // Points to the NEXT index to write (Circular)
+  int count;  // Number of history points filled
+
+  // Values of the registered indicators, refreshed in one pass on the first
+  // read after a tick (stockIndicators)
+  float indicators[MAX_INDICATORS];
 } Stock;
 
-// 4. AVL Tree Node (Sorted by % Gain)
-typedef struct AVL {
-  Stock *stock;
+// 3c. Hot per-stock scalars as parallel arrays indexed by Stock.id. A heap
+// sift or a market-wide scan reads a few dense arrays instead of one ~3 KB
+// Stock per element. Shard workers only write their own stocks' entries.
+typedef struct StockHot {
+  int64_t *price; // Current price (ticks)
+  int64_t *buy;   // Buy price (ticks)
+  int *quantity;
+  float *gain;     // Percent gain, kept in step with price (setPrice)
+  int *maxHeapIdx; // Position in its shard's heaps (for O(log4 N) updates)
+  int *minHeapIdx;
+} StockHot;
+
+// 4. Immutable copy of the fields a snapshot read reports
+typedef struct StockView {
+  int stock; // Symbol id (the name is looked up when printing)
+  int quantity;
+  int64_t buyPrice; // Prices and alerts in ticks
+  int64_t currentPrice;
+  int64_t upperAlert;
+  int64_t lowerAlert;
+  float percentGain;
+  float sma;
+  float rsi;
+} StockView;
+
+// 4b. Node of the persistent (path-copying) name tree behind snapshots.
+// Published nodes are never written again. A node created for the version
+// still being built is private to the engine and is edited in place.
+typedef struct SnapNode {
+  StockView view;
+  unsigned long version; // Version that created this node
+  int height;
+  uint64_t invest; // Subtree totals of buyPrice * quantity, in ticks
+  uint64_t value;  // ... and currentPrice * quantity (both mod 2^64)
+  struct SnapNode *left, *right;
+  struct SnapNode *nextGarbage; // Link while waiting to be freed
+} SnapNode;
+
+// 4c. Published read-only version of the portfolio
+typedef struct Snapshot {
+  unsigned long version;
+  SnapNode *root;
+  int count;
+  bool hasTop;
+  StockView topGainer;
+  StockView topLoser;
+  atomic_int pins;        // Readers still using this version
+  SnapNode *garbage;      // Nodes of the previous version this one replaced
+  struct Snapshot *next;  // Next newer version
+} Snapshot;
+
+// 5. Symbol Table. A symbol is interned once, on ADD: trees, heaps, logs
+// and views store its id (the registry index), and the name is only read
+// again to print it. Names are NUL padded, so comparing two of them is one
+// fixed-size memcmp.
+typedef struct Symbol {
+  char name[NAME_LEN];
+  uint32_t hash; // hashSymbol(name), which picks the shard
+} Symbol;
+
+// Each shard maps its names to ids with open addressing (Robin Hood
+// probing). A slot keeps the full 32-bit hash as a fingerprint, so a probe
+// only reads the name (and pays a strcmp) when the fingerprints match.
+typedef struct HashSlot {
+  uint32_t hash; // 0 = empty slot
+  int id;
+} HashSlot;
+
+typedef struct HashTable {
+  HashSlot *slots;
+  uint32_t mask; // capacity - 1 (capacity is always a power of two)
+  uint32_t size;
+} HashTable;
+
+// 5b. Order-Statistic Tree Node keyed by (percentGain, symbol id)
+// 'key' is the gain at the time of the last reposition, so the node can be
+// found again after the stock's price has changed. Nodes live in a per-shard
+// pool and link by index (0 = none), so a tree can be saved and mapped back
+// at any address.
+typedef struct RankNode {
+  float key;
   int height;
-  struct AVL *left, *right;
-} AVL;
+  int size;  // Nodes in this subtree (for rank/select)
+  int stock; // Registry index
+  int left, right;
+} RankNode;
+
+// 6. Oversold set: the shard's stocks with RSI(14) < OVERSOLD_RSI. A stock
+// joins or leaves when a tick crosses the threshold; Stock.oversoldIdx
+// makes leaving a swap with the last member.
+typedef struct OversoldSet {
+  Stock **members;
+  int count;
+} OversoldSet;
+
+// 7. Parsed tick waiting in a shard's slice of the current batch
+typedef struct BatchTick {
+  char name[NAME_LEN];
+  uint32_t hash;
+  unsigned long seq; // Transaction sequence number, assigned when queued
+  int64_t price;
+  int qty;
+} BatchTick;
+
+// 7b. Heap entry: the ordering key is kept next to the stock id, so a sift
+// only reads the heap array. Min heaps store the negated gain.
+typedef struct HeapEntry {
+  float key;
+  int id;
+} HeapEntry;
+
+// 7c. Slab pool: fixed-size elements carved from large slabs, with a free
+// list for recycling. Freeing the slabs releases every element at once.
+typedef struct SlabPool {
+  size_t elemSize; // Rounded up to 16 bytes, so every element is aligned
+  int slabElems;   // Elements per slab
+  char **slabs;
+  int slabCount, slabCap;
+  int slabUsed;   // Elements carved from the newest slab so far
+  void *freeList; // Released elements, linked through their first bytes
+  unsigned long allocs;
+  unsigned long reused; // Allocations served from the free list
+  long live;
+} SlabPool;
+
+#define SLAB_POOL(type, n)                                                   \
+  { .elemSize = (sizeof(type) + 15) / 16 * 16, .slabElems = (n) }
+
+// 8. Shard: the symbols whose hash maps here, with every structure that a
+// tick mutates. During a batch only the shard's worker thread touches it;
+// between batches the main thread owns all shards (ADD, reads, merges).
+typedef struct Shard {
+  // Aligned so workers writing their own shard never share a cache line
+  _Alignas(64) HashTable table;
+  // While growing, entries are migrated from oldTable into table a few
+  // slots per insert, so no single ADD pays for a full rehash.
+  HashTable oldTable;
+  uint32_t migrateIdx;
+  RankNode *rankPool; // This shard's stocks by gain (slot 0 unused)
+  int rankCount;       // Pool slots in use, including slot 0
+  int rankCap;
+  int rankRoot;
+  HeapEntry *maxHeap;
+  HeapEntry *minHeap; // Keyed by -gain, so both are max-heaps
+  int heapSize; // Shared size for simplicity (all stocks in both)
+  int heapCap;  // Also the capacity of oversold.members
+  OversoldSet oversold;
+  TransactionLog log;
+  SlabPool segments; // Where 'log' gets its segments
+  unsigned long indicatorHits;   // Indicator reads served from the cache
+  unsigned long indicatorMisses; // Reads that had to refresh it first
+
+  // Stocks touched by the current batch (reordered once at the end)
+  Stock **batchTouched;
+  int batchTouchedCount;
+  int batchTouchedCap;
+
+  BatchTick *work; // This shard's slice of the batch being applied
+  int workCount;
+  int workCap;
+  int applied; // Ticks of 'work' that matched a stock
+  pthread_t thread;
+
+  Stock **dirty; // Stocks to copy into the next snapshot
+  int dirtyCount;
+  int dirtyCap;
+} Shard;
+
+// 9. In-order cursor, used to merge the per-shard gain trees into one order
+typedef struct RankCursor {
+  Shard *sh;
+  int stack[64]; // Bounded by the AVL height (< 1.45 log2 N)
+  int top;
+  bool descending;
+} RankCursor;
+
+// 10. Single-producer/single-consumer ring of fixed-size elements.
+// head and tail only ever grow (slot = counter & mask) and live on separate
+// cache lines; each side also caches its last view of the other's counter,
+// so the shared lines are only read when the ring looks full or empty.
+typedef struct SpscRing {
+  _Alignas(64) atomic_size_t head; // Next element to pop (consumer)
+  size_t tailCache;                // Consumer's last view of tail
+  _Alignas(64) atomic_size_t tail; // Next element to push (producer)
+  size_t headCache;                // Producer's last view of head
+  _Alignas(64) unsigned char *slots;
+  size_t mask;
+  size_t elemSize;
+  atomic_ulong fullStalls;  // Pushes that found the ring full
+  atomic_ulong emptyStalls; // Pops that found the ring empty
+  atomic_size_t highWater;  // Deepest the ring has been (upper bound)
+  atomic_int parked;        // Stalled sides asleep on 'wake' (0..2)
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} SpscRing;
+
+// 11. Command record passed from the reader thread to the engine thread.
+// UPDATEBATCH ticks follow their header as REC_TICKS records, the last one
+// flagged, so the engine never touches stdin.
+typedef enum { REC_TEXT, REC_FRAME, REC_TICKS, REC_END } RecordKind;
+
+typedef struct RecordTick {
+  int64_t price;
+  char name[NAME_LEN]; // Empty if the tick line was malformed
+  int qty;
+} RecordTick;
+
+typedef struct CmdRecord {
+  uint8_t kind;     // RecordKind
+  uint8_t op;       // Binary opcode (REC_FRAME)
+  uint16_t count;   // Payload bytes (REC_FRAME) or ticks (REC_TICKS)
+  bool tagged;      // Text line carried a "#id" tag
+  bool ticksFollow; // REC_FRAME batch header is valid and its ticks follow
+  bool last;        // Final REC_TICKS record of a batch
+  unsigned long id; // Text tag or frame request ID
+  union {
+    char line[CMD_LINE_LEN];
+    uint8_t payload[CMD_LINE_LEN];
+    RecordTick ticks[RECORD_TICKS];
+  };
+} CmdRecord;
+
+// 12. Write-ahead log record. Fixed size, and 'check' covers the rest of
+// the record, so a tail torn by a crash is detected and ignored.
+typedef enum {
+  WAL_ADD = 1,  // name, price = buy price, value = quantity
+  WAL_UPDATE,   // single UPDATE: name, price, value = quantity
+  WAL_TICK,     // batch tick, queued until the next WAL_APPLY
+  WAL_APPLY,    // end of a batch
+  WAL_INDICATOR, // name = "SMA" or "RSI", value = period
+  WAL_RESET      // every stock dropped
+} WalType;
+
+typedef struct WalRecord {
+  uint32_t check; // FNV-1a of the bytes that follow
+  uint8_t type;   // WalType
+  uint8_t reserved[3];
+  int64_t price; // Ticks
+  int32_t value;
+  char name[NAME_LEN];
+} WalRecord;
+
+// 13. Checkpoint image. Every section starts at a 64-byte aligned offset
+// from the start of the file and holds no pointers, so the file can be
+// mapped at any address: the Stock array is used in place, and only the
+// index arrays get a fix-up pass (stock ids become pointers) on load.
+typedef struct ShardImage {
+  uint64_t slotsOffset; // HashSlot[tableMask + 1]
+  uint64_t rankOffset;  // RankNode[rankCount]
+  uint64_t heapsOffset; // uint32_t registry indexes: max heap, min heap,
+                        // then the oversold set
+  uint32_t tableMask;
+  uint32_t tableSize;
+  int32_t rankCount;
+  int32_t rankRoot;
+  int32_t heapSize;
+  int32_t oversoldCount;
+} ShardImage;
+
+typedef struct CheckpointHeader {
+  char magic[8]; // "DSA2IMG"
+  uint32_t format;
+  uint32_t stockSize;  // sizeof(Stock): an image only fits the same layout
+  uint32_t priceScale; // PRICE_SCALE the prices were stored with
+  uint32_t stockCount;
+  uint32_t transactionCount;
+  uint32_t indicatorCount;
+  uint32_t shardCount;
+  IndicatorSpec indicators[MAX_INDICATORS];
+  uint64_t walGen;             // First log file not covered by the image
+  uint64_t transSeq;           // Next transaction sequence number
+  uint64_t symbolsOffset;      // Symbol[stockCount] in id order
+  uint64_t stocksOffset;       // Stock[stockCount] in registry order
+  uint64_t hotOffset;          // Hot price, buy, gain, quantity columns
+  uint64_t transactionsOffset; // Transaction[transactionCount], oldest first
+  ShardImage shards[MAX_SHARDS];
+} CheckpointHeader;
+
+// 14. Progress of a background checkpoint, in a page shared with the child
+typedef struct CheckpointProgress {
+  atomic_ulong written; // Image bytes written so far
+  atomic_ulong total;   // Image size, once laid out
+} CheckpointProgress;
+
+// 15. Correlation row bookkeeping (the rows themselves are one float pool)
+// and a candidate pair kept while selecting the strongest correlations
+typedef struct CorrSlot {
+  int stock;  // Registry id
+  bool valid; // False for a flat window (no variance)
+  long ticks; // Stock tick count the row was built at, -1 for never
+} CorrSlot;
+
+typedef struct CorrEdge {
+  int a, b; // Row slots
+  float corr;
+  float key; // Ordering key: corr, or |corr| for edge lists
+} CorrEdge;
+
 
 /* --- GLOBALS --- */
-Stock *hashTable[HASH_SIZE] = {0};
-AVL *avlRoot = NULL;
-Stock *maxHeap[MAX_STOCKS];
-Stock *minHeap[MAX_STOCKS];
-int heapSize = 0; // Shared size for simplicity (assuming all stocks in both)
-
-Transaction *transHead = NULL;
-TrieNode *trieRoot = NULL;
-
-// Correlation Matrix (1 = Correlated, 0 = No)
-int correlationGraph[MAX_STOCKS][MAX_STOCKS];
-Stock *stockRegistry[MAX_STOCKS]; // Map ID to Stock Pointer
+Shard shards[MAX_SHARDS];
+int shardCount = 1;
+unsigned long transSeq = 0; // Next sequence number (main thread only)
+int logMaxSegments = 1;     // Per-shard segment limit, set by startShards
+
+// Worker pool: the main thread bumps poolGeneration to hand every worker
+// its slice of a batch, then sleeps until poolPending drops to zero.
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+unsigned long poolGeneration = 0;
+int poolPending = 0;
+bool poolStarted = false;
+
+TrieNode *triePool = NULL; // Symbol trie (engine thread only)
+int trieCount = 0, trieCap = 0;
+int trieIndexed = 0; // Registry entries inserted so far (filled on search)
+
+// Indicators computed for every stock on each tick (SMA 5 / RSI 14 built in)
+IndicatorSpec indicatorSpecs[MAX_INDICATORS] = {{IND_SMA, 5}, {IND_RSI, 14}};
+int indicatorCount = 2;
+
+// Interned names by id. Chunk c holds the 2^(c + SYMBOL_CHUNK_BITS) ids
+// from (2^c - 1) << SYMBOL_CHUNK_BITS on and never moves, so query threads
+// can resolve the ids in a snapshot while ADD grows the table.
+Symbol *symbolChunks[32 - SYMBOL_CHUNK_BITS];
+
+// The registry spans all shards and only changes on ADD (main thread).
+Stock **stockRegistry = NULL; // Map ID to Stock Pointer
+StockHot hot = {0};           // Hot columns, same indexing and capacity
+SlabPool stockPool = SLAB_POOL(Stock, STOCK_SLAB); // Stocks added by ADD
 int registryCount = 0;
+int stockCapacity = 0; // Allocated registry and column slots
 
 /* --- PROTOTYPES --- */
-void updateStockPrice(char *name, float newPrice, int newQty, bool isAuto);
+Status updateStockPrice(const char *name, int64_t newPrice, int newQty,
+                        bool isAuto);
 float getPercent(Stock *s);
+const float *stockIndicators(Shard *sh, Stock *s);
+int runPipeline(void *(*reader)(void *));
+void snapMarkDirty(Shard *sh, Stock *s);
+void linkStock(Shard *sh, uint32_t h, Stock *s);
+void walLog(WalType type, const char *name, int64_t price, int value);
+unsigned long walSubmit();
+void printWalStats();
+void cmdCheckpoint();
+void makeDataDir();
+bool checkpoint();
+bool checkpointStart();
+bool checkpointPoll(bool wait);
+void benchCheckpoint(uint32_t *rng);
+void benchStocksJSON();
+void imageRelease();
+long residentBytes();
 
 /* ================= UTILITIES & MATH ================= */
 
-int hash(const char *str) {
-  unsigned long hash = 5381;
+uint32_t hashSymbol(const char *str) {
+  uint32_t hash = 5381;
   int c;
   while ((c = *str++))
     hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-  return abs((int)(hash % HASH_SIZE));
+  // Final avalanche so the low bits used for the slot index are well mixed
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash ? hash : 1; // 0 is reserved for empty slots
 }
 
 float max_f(float a, float b) { return (a > b) ? a : b; }
 int max_i(int a, int b) { return (a > b) ? a : b; }
-
-/* ================= FENWICK TREE (BIT) ================= */
-// Operations are O(log N)
-
-// Update index 'i' by adding 'delta'
-void bit_update(float *bit, int idx, float delta) {
-  idx++; // Convert 0-based array index to 1-based BIT index
-  while (idx <= HISTORY_SIZE) {
-    bit[idx] += delta;
-    idx += idx & (-idx);
+int min_i(int a, int b) { return (a < b) ? a : b; }
+
+const char *statusMessage(Status st) {
+  switch (st) {
+  case ST_OK:
+    return "OK";
+  case ST_EXISTS:
+    return "Stock already exists";
+  case ST_NOT_FOUND:
+    return "Stock not found";
+  case ST_BAD_SYMBOL:
+    return "Invalid symbol";
+  case ST_NO_MEMORY:
+    return "Out of memory";
   }
+  return "Unknown error";
 }
 
-// Prefix sum up to index 'i'
-float bit_query(float *bit, int idx) {
-  idx++; // Convert 0-based array index to 1-based BIT index
-  float sum = 0;
-  while (idx > 0) {
-    sum += bit[idx];
-    idx -= idx & (-idx);
-  }
-  return sum;
-}
+/* ================= PRICES ================= */
+// Prices are fixed point: int64 counts of 1/PRICE_SCALE rupee ("ticks"), so
+// sums, differences and P&L are exact. Decimal text is converted at the
+// edges; gains and indicators are ratios and stay floating point.
 
-// Range sum [L, R] handling circular wrapping manually in caller if needed
-// This function strictly calculates linear range sum in the underlying array
-float bit_query_range(float *bit, int L, int R) {
-  if (L > R)
-    return 0;
-  return bit_query(bit, R) - bit_query(bit, L - 1);
-}
+#if PRICE_SCALE % 100 != 0
+#error "PRICE_SCALE must be a multiple of 100 (prices print to the paisa)"
+#endif
 
-/* ================= TRIE ================= */
-// Operations O(L)
+double priceValue(int64_t ticks) { return (double)ticks / PRICE_SCALE; }
 
-TrieNode *createTrieNode() {
-  TrieNode *node = (TrieNode *)calloc(1, sizeof(TrieNode));
-  return node;
+// Nearest tick to a rupee amount; false for NaN or out of range
+bool priceFromDouble(double v, int64_t *ticks) {
+  double t = round(v * PRICE_SCALE);
+  if (!(fabs(t) <= (double)PRICE_MAX))
+    return false;
+  *ticks = (int64_t)t;
+  return true;
 }
 
-void insertTrie(const char *word) {
-  if (!trieRoot)
-    trieRoot = createTrieNode();
-  TrieNode *curr = trieRoot;
-  for (int i = 0; word[i]; i++) {
-    int idx = word[i] - 'A';
-    if (idx < 0 || idx >= 26)
-      continue; // Basic sanitization
-    if (!curr->children[idx])
-      curr->children[idx] = createTrieNode();
-    curr = curr->children[idx];
+// Parse a decimal price ("2380", "-0.5", "99.99") into ticks. Digits past
+// the tick round half away from zero; only exponent forms ("1e3") go
+// through strtod. Returns the end of the number, or NULL if there is none
+// or it is out of range.
+const char *priceParse(const char *str, int64_t *ticks) {
+  const char *p = str;
+  while (*p == ' ' || *p == '\t')
+    p++;
+  bool neg = *p == '-';
+  if (*p == '-' || *p == '+')
+    p++;
+  uint64_t whole = 0, frac = 0;
+  int place = PRICE_SCALE; // Ticks per unit of the next fraction digit
+  bool digits = false, roundUp = false;
+  for (; *p >= '0' && *p <= '9'; p++, digits = true)
+    if (whole <= (uint64_t)PRICE_MAX) // Saturate; rejected below
+      whole = whole * 10 + (uint64_t)(*p - '0');
+  if (*p == '.')
+    for (p++; *p >= '0' && *p <= '9'; p++, digits = true) {
+      if (place > 1) {
+        place /= 10;
+        frac += (uint64_t)(*p - '0') * place;
+      } else if (place == 1) {
+        roundUp = *p >= '5';
+        place = 0;
+      }
+    }
+  if (!digits)
+    return NULL;
+  if (*p == 'e' || *p == 'E') {
+    char *end;
+    double v = strtod(str, &end);
+    return priceFromDouble(v, ticks) ? end : NULL;
   }
-  curr->isEndOfWord = true;
+  if (whole > (uint64_t)PRICE_MAX / PRICE_SCALE)
+    return NULL;
+  uint64_t v = whole * PRICE_SCALE + frac + roundUp;
+  if (v > (uint64_t)PRICE_MAX)
+    return NULL;
+  *ticks = neg ? -(int64_t)v : (int64_t)v;
+  return p;
 }
 
-bool searchTrie(const char *word) {
-  if (!trieRoot)
-    return false;
-  TrieNode *curr = trieRoot;
-  for (int i = 0; word[i]; i++) {
-    int idx = word[i] - 'A';
-    if (idx < 0 || idx >= 26)
-      return false;
-    if (!curr->children[idx])
-      return false;
-    curr = curr->children[idx];
+/* ================= SLAB POOLS ================= */
+// Nodes of one type come from a few large slabs instead of one malloc each,
+// so they sit together in memory and a reset frees O(#slabs) blocks.
+
+void *poolAlloc(SlabPool *p) {
+  void *e = p->freeList;
+  if (e) {
+    memcpy(&p->freeList, e, sizeof(void *));
+    p->reused++;
+  } else {
+    if (p->slabCount == 0 || p->slabUsed == p->slabElems) {
+      if (p->slabCount == p->slabCap) {
+        int cap = p->slabCap ? p->slabCap * 2 : 16;
+        char **slabs = (char **)realloc(p->slabs, cap * sizeof(char *));
+        if (!slabs)
+          return NULL;
+        p->slabs = slabs;
+        p->slabCap = cap;
+      }
+      char *slab = (char *)malloc(p->elemSize * p->slabElems);
+      if (!slab)
+        return NULL;
+      p->slabs[p->slabCount++] = slab;
+      p->slabUsed = 0;
+    }
+    e = p->slabs[p->slabCount - 1] + p->elemSize * p->slabUsed++;
   }
-  return curr->isEndOfWord;
+  p->allocs++;
+  p->live++;
+  return e;
 }
 
-/* ================= AVL TREE ================= */
-// Operations O(log N)
-
-int getHeight(AVL *n) { return n ? n->height : 0; }
-int getBalance(AVL *n) {
-  return n ? getHeight(n->left) - getHeight(n->right) : 0;
+void poolFree(SlabPool *p, void *e) {
+  memcpy(e, &p->freeList, sizeof(void *));
+  p->freeList = e;
+  p->live--;
 }
 
-AVL *rightRotate(AVL *y) {
-  AVL *x = y->left;
-  AVL *T2 = x->right;
-  x->right = y;
-  y->left = T2;
-  y->height = max_i(getHeight(y->left), getHeight(y->right)) + 1;
-  x->height = max_i(getHeight(x->left), getHeight(x->right)) + 1;
-  return x;
+// Release every element at once; the pool stays usable
+void poolReset(SlabPool *p) {
+  for (int i = 0; i < p->slabCount; i++)
+    free(p->slabs[i]);
+  free(p->slabs);
+  p->slabs = NULL;
+  p->slabCount = p->slabCap = p->slabUsed = 0;
+  p->freeList = NULL;
+  p->live = 0;
 }
 
-AVL *leftRotate(AVL *x) {
-  AVL *y = x->right;
-  AVL *T2 = y->left;
-  y->left = x;
-  x->right = T2;
-  x->height = max_i(getHeight(x->left), getHeight(x->right)) + 1;
-  y->height = max_i(getHeight(y->left), getHeight(y->right)) + 1;
-  return y;
+/* ================= WINDOW AGGREGATES ================= */
+// The sum over the last p ticks is prefix[T] - prefix[T - p]: O(1) for any
+// period, and ticks that fall out of the window need no explicit eviction.
+
+// The sums are integers, so the result is exact however long the process
+// runs (the prefixes wrap, their difference does not).
+int64_t windowSum(const uint64_t *cum, Stock *s, int period) {
+  return (int64_t)(cum[s->ticks % PREFIX_SLOTS] -
+                   cum[(s->ticks - period) % PREFIX_SLOTS]);
 }
 
-// Standard AVL Insert based on Name (since % gain changes dynamically,
-// usually AVL is keyed by ID/Name, or requires Delete/Re-insert on update.
-// Here we key by Name to keep structure valid. For Sorted display, we do
-// in-order traversal).
-AVL *insertAVL(AVL *node, Stock *s) {
-  if (!node) {
-    AVL *n = (AVL *)malloc(sizeof(AVL));
-    n->stock = s;
-    n->left = n->right = NULL;
-    n->height = 1;
-    return n;
+// Record a new tick in the history ring and the prefix sums
+void windowPush(Stock *s, int64_t price) {
+  int64_t gain = 0, loss = 0;
+  if (s->ticks > 0) {
+    int64_t prev =
+        s->priceHistory[(s->head - 1 + HISTORY_SIZE) % HISTORY_SIZE];
+    int64_t change = price - prev;
+    gain = (change > 0) ? change : 0;
+    loss = (change < 0) ? -change : 0;
   }
-  if (strcmp(s->name, node->stock->name) < 0)
-    node->left = insertAVL(node->left, s);
-  else if (strcmp(s->name, node->stock->name) > 0)
-    node->right = insertAVL(node->right, s);
-  else
-    return node;
 
-  node->height = 1 + max_i(getHeight(node->left), getHeight(node->right));
-  int balance = getBalance(node);
+  int prevSlot = s->ticks % PREFIX_SLOTS;
+  int slot = (s->ticks + 1) % PREFIX_SLOTS;
+  s->cumPrice[slot] = s->cumPrice[prevSlot] + (uint64_t)price;
+  s->cumGain[slot] = s->cumGain[prevSlot] + (uint64_t)gain;
+  s->cumLoss[slot] = s->cumLoss[prevSlot] + (uint64_t)loss;
+  s->ticks++;
 
-  if (balance > 1 && strcmp(s->name, node->left->stock->name) < 0)
-    return rightRotate(node);
-  if (balance < -1 && strcmp(s->name, node->right->stock->name) > 0)
-    return leftRotate(node);
-  if (balance > 1 && strcmp(s->name, node->left->stock->name) > 0) {
-    node->left = leftRotate(node->left);
-    return rightRotate(node);
-  }
-  if (balance < -1 && strcmp(s->name, node->right->stock->name) < 0) {
-    node->right = rightRotate(node->right);
-    return leftRotate(node);
-  }
-  return node;
+  s->priceHistory[s->head] = price;
+  s->head = (s->head + 1) % HISTORY_SIZE;
+  if (s->count < HISTORY_SIZE)
+    s->count++;
 }
 
-// In-order Traversal to print sorted by % Gain (calculated on fly)
-// Note: To strictly SORT by gain, the tree must be keyed by gain.
-// For this project, we iterate the AVL (alphabetical) but can dump to array to
-// sort for display. We will just print the AVL contents here.
-void inOrderAVL(AVL *root) {
-  if (root) {
-    inOrderAVL(root->left);
-    printf("  %-10s | %6.2f%%\n", root->stock->name, getPercent(root->stock));
-    inOrderAVL(root->right);
-  }
+/* ================= SYMBOLS ================= */
+// Names live here, by id; everything past the API boundary works on ids.
+
+Symbol *symbolAt(int id) {
+  uint32_t i = (uint32_t)id + (1u << SYMBOL_CHUNK_BITS);
+#if defined(__GNUC__) || defined(__clang__)
+  int top = 31 - __builtin_clz(i);
+#else
+  int top = SYMBOL_CHUNK_BITS;
+  while (i >> (top + 1))
+    top++;
+#endif
+  return &symbolChunks[top - SYMBOL_CHUNK_BITS][i - (1u << top)];
 }
 
-/* ================= HEAPS (Max & Min) ================= */
-// Operations O(log N)
-
-void swapStocks(Stock **a, Stock **b) {
-  Stock *temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-// Generic Heapify
-void heapifyMax(int idx) {
-  int largest = idx;
-  int left = 2 * idx + 1;
-  int right = 2 * idx + 2;
-
-  if (left < heapSize &&
-      getPercent(maxHeap[left]) > getPercent(maxHeap[largest]))
-    largest = left;
-  if (right < heapSize &&
-      getPercent(maxHeap[right]) > getPercent(maxHeap[largest]))
-    largest = right;
-
-  if (largest != idx) {
-    // Swap pointers in heap array
-    swapStocks(&maxHeap[idx], &maxHeap[largest]);
-    // Update indices in Stock structs
-    maxHeap[idx]->maxHeapIdx = idx;
-    maxHeap[largest]->maxHeapIdx = largest;
-    heapifyMax(largest);
-  }
-}
-
-void heapifyMin(int idx) {
-  int smallest = idx;
-  int left = 2 * idx + 1;
-  int right = 2 * idx + 2;
-
-  if (left < heapSize &&
-      getPercent(minHeap[left]) < getPercent(minHeap[smallest]))
-    smallest = left;
-  if (right < heapSize &&
-      getPercent(minHeap[right]) < getPercent(minHeap[smallest]))
-    smallest = right;
-
-  if (smallest != idx) {
-    swapStocks(&minHeap[idx], &minHeap[smallest]);
-    minHeap[idx]->minHeapIdx = idx;
-    minHeap[smallest]->minHeapIdx = smallest;
-    heapifyMin(smallest);
-  }
-}
-
-void updateHeaps(Stock *s) {
-  // Bubble Up/Down Max Heap
-  int i = s->maxHeapIdx;
-  while (i && getPercent(maxHeap[i]) > getPercent(maxHeap[(i - 1) / 2])) {
-    int p = (i - 1) / 2;
-    swapStocks(&maxHeap[i], &maxHeap[p]);
-    maxHeap[i]->maxHeapIdx = i;
-    maxHeap[p]->maxHeapIdx = p;
-    i = p;
-  }
-  heapifyMax(s->maxHeapIdx);
+const char *symbolName(int id) { return symbolAt(id)->name; }
 
-  // Bubble Up/Down Min Heap
-  i = s->minHeapIdx;
-  while (i && getPercent(minHeap[i]) < getPercent(minHeap[(i - 1) / 2])) {
-    int p = (i - 1) / 2;
-    swapStocks(&minHeap[i], &minHeap[p]);
-    minHeap[i]->minHeapIdx = i;
-    minHeap[p]->minHeapIdx = p;
-    i = p;
-  }
-  heapifyMin(s->minHeapIdx);
+// Name order of two interned symbols (the same as strcmp of the names)
+int symbolCompare(int a, int b) {
+  return a == b ? 0 : memcmp(symbolName(a), symbolName(b), NAME_LEN);
 }
 
-/* ================= CORE LOGIC ================= */
-
-Stock *findStock(char *name) {
-  int h = hash(name);
-  Stock *s = hashTable[h];
-  while (s) {
-    if (strcmp(s->name, name) == 0)
-      return s;
-    s = s->next;
+// Chunks for ids below 'needed'
+bool reserveSymbols(int needed) {
+  for (int c = 0; (((uint64_t)1 << c) - 1) << SYMBOL_CHUNK_BITS <
+                  (uint64_t)needed;
+       c++) {
+    if (symbolChunks[c])
+      continue;
+    size_t names = (size_t)1 << (c + SYMBOL_CHUNK_BITS);
+    symbolChunks[c] = (Symbol *)malloc(names * sizeof(Symbol));
+    if (!symbolChunks[c])
+      return false;
   }
-  return NULL;
+  return true;
 }
 
-float getPercent(Stock *s) {
-  if (s->buyPrice == 0)
-    return 0;
-  return ((s->currentPrice - s->buyPrice) / s->buyPrice) * 100.0f;
+// Record the name of a new id ('name' is shorter than NAME_LEN)
+void symbolIntern(int id, const char *name, uint32_t hash) {
+  Symbol *sym = symbolAt(id);
+  strncpy(sym->name, name, NAME_LEN - 1); // Pads with NULs
+  sym->name[NAME_LEN - 1] = '\0';
+  sym->hash = hash;
 }
 
-// CALCULATE SMA using Fenwick Tree
-float calculateSMA(Stock *s, int period) {
-  if (s->count < period)
-    period = s->count; // Fallback
-  if (period == 0)
-    return s->currentPrice;
+/* ================= SYMBOL TABLE (Robin Hood) ================= */
+// Lookup and insert are O(1) expected; probe sequences stay short because
+// Robin Hood insertion bounds the variance of probe distances.
 
-  // The circular buffer logical end is (head - 1)
-  int logicalEnd = (s->head - 1 + HISTORY_SIZE) % HISTORY_SIZE;
-  int logicalStart = (s->head - period + HISTORY_SIZE) % HISTORY_SIZE;
+uint32_t probeDistance(HashTable *t, uint32_t hash, uint32_t idx) {
+  return (idx - (hash & t->mask)) & t->mask;
+}
 
-  float sum = 0;
-  // If range does not wrap around underlying array
-  if (logicalStart <= logicalEnd) {
-    sum = bit_query_range(s->bit_price, logicalStart, logicalEnd);
-  } else {
-    // Wraps around: [logicalStart...End] + [0...logicalEnd]
-    sum = bit_query_range(s->bit_price, logicalStart, HISTORY_SIZE - 1) +
-          bit_query_range(s->bit_price, 0, logicalEnd);
+// Symbol id of 'name', or -1
+int htLookup(HashTable *t, uint32_t hash, const char *name) {
+  if (!t->slots)
+    return -1;
+  uint32_t idx = hash & t->mask;
+  for (uint32_t dist = 0;; dist++) {
+    HashSlot *slot = &t->slots[idx];
+    // Stop at an empty slot or at an entry "richer" than us: with Robin Hood
+    // ordering the key cannot be further along the probe sequence.
+    if (slot->hash == 0 || probeDistance(t, slot->hash, idx) < dist)
+      return -1;
+    if (slot->hash == hash && strcmp(symbolName(slot->id), name) == 0)
+      return slot->id;
+    idx = (idx + 1) & t->mask;
   }
-  return sum / period;
 }
 
-// CALCULATE RSI using Fenwick Trees for Gains and Losses
-float calculateRSI(Stock *s, int period) {
-  if (s->count < period + 1)
-    return 50.0; // Needs period + 1 points for 'period' changes
-
-  int logicalEnd = (s->head - 1 + HISTORY_SIZE) % HISTORY_SIZE;
-  int logicalStart = (s->head - period + HISTORY_SIZE) % HISTORY_SIZE;
-
-  float totalGain = 0, totalLoss = 0;
-
-  if (logicalStart <= logicalEnd) {
-    totalGain = bit_query_range(s->bit_gain, logicalStart, logicalEnd);
-    totalLoss = bit_query_range(s->bit_loss, logicalStart, logicalEnd);
-  } else {
-    totalGain = bit_query_range(s->bit_gain, logicalStart, HISTORY_SIZE - 1) +
-                bit_query_range(s->bit_gain, 0, logicalEnd);
-    totalLoss = bit_query_range(s->bit_loss, logicalStart, HISTORY_SIZE - 1) +
-                bit_query_range(s->bit_loss, 0, logicalEnd);
+// Insert assuming the key is absent and the table has a free slot
+void htPlace(HashTable *t, uint32_t hash, int id) {
+  uint32_t idx = hash & t->mask;
+  uint32_t dist = 0;
+  while (t->slots[idx].hash != 0) {
+    uint32_t existing = probeDistance(t, t->slots[idx].hash, idx);
+    if (existing < dist) {
+      // Steal the slot from the richer entry and keep inserting it instead
+      HashSlot tmp = t->slots[idx];
+      t->slots[idx].hash = hash;
+      t->slots[idx].id = id;
+      hash = tmp.hash;
+      id = tmp.id;
+      dist = existing;
+    }
+    idx = (idx + 1) & t->mask;
+    dist++;
   }
-
-  float avgGain = totalGain / period;
-  float avgLoss = totalLoss / period;
-
-  if (avgLoss == 0)
-    return 100.0;
-  float rs = avgGain / avgLoss;
-  return 100.0 - (100.0 / (1.0 + rs));
+  t->slots[idx].hash = hash;
+  t->slots[idx].id = id;
+  t->size++;
 }
 
-// Add Transaction Log
-void logTransaction(const char *type, const char *name, float price) {
-  Transaction *t = (Transaction *)malloc(sizeof(Transaction));
-  strcpy(t->type, type);
-  strcpy(t->symbol, name);
-  t->price = price;
-  t->next = transHead;
-  transHead = t;
+// Move up to 'steps' slots of the shard's old table into the new one
+void htMigrate(Shard *sh, uint32_t steps) {
+  while (sh->oldTable.slots && steps--) {
+    HashSlot *slot = &sh->oldTable.slots[sh->migrateIdx];
+    if (slot->hash != 0)
+      htPlace(&sh->table, slot->hash, slot->id);
+    if (sh->migrateIdx++ == sh->oldTable.mask) {
+      free(sh->oldTable.slots);
+      sh->oldTable = (HashTable){0};
+      sh->migrateIdx = 0;
+    }
+  }
 }
 
-// Create Stock
-void addStock(char *name, float buyPrice, int qty) {
-  if (registryCount >= MAX_STOCKS) {
-    printf("Error: Max stocks reached.\n");
-    return;
-  }
-  if (findStock(name)) {
-    printf("Error: Stock %s already exists.\n", name);
-    return;
-  }
+// Doubling the capacity means migration (HASH_MIGRATE_STEP slots per insert)
+// completes long before the new table approaches its load limit.
+void htGrow(Shard *sh) {
+  // Finish any resize still in flight before starting the next one
+  htMigrate(sh, UINT32_MAX);
+  uint32_t cap = sh->table.slots ? (sh->table.mask + 1) * 2 : HASH_INIT_CAP;
+  sh->oldTable = sh->table;
+  sh->table.slots = (HashSlot *)calloc(cap, sizeof(HashSlot));
+  sh->table.mask = cap - 1;
+  sh->table.size = 0;
+  sh->migrateIdx = 0;
+}
 
-  Stock *s = (Stock *)calloc(1, sizeof(Stock));
-  strcpy(s->name, name);
-  s->buyPrice = buyPrice;
-  s->currentPrice = buyPrice;
-  s->quantity = qty;
-  s->upperAlert = buyPrice * 1.10;
-  s->lowerAlert = buyPrice * 0.90;
+void htInsert(Shard *sh, uint32_t h, int id) {
+  // Keep load factor below 7/8
+  if (!sh->table.slots || (uint64_t)(sh->table.size + 1) * 8 >
+                              (uint64_t)(sh->table.mask + 1) * 7)
+    htGrow(sh);
+  htPlace(&sh->table, h, id);
+  htMigrate(sh, HASH_MIGRATE_STEP);
+}
 
-  // Init History
-  s->head = 0;
-  s->count = 0;
+/* ================= SHARDS ================= */
+// A symbol's shard comes from the high bits of its hash; the tables index
+// slots with the low bits, so each shard still sees well spread keys.
 
-  // Add initial price to history/BIT
-  s->priceHistory[0] = buyPrice;
-  bit_update(s->bit_price, 0, buyPrice);
-  s->head = 1;
-  s->count = 1;
+Shard *shardFor(uint32_t hash) {
+  return &shards[((uint64_t)hash * (uint32_t)shardCount) >> 32];
+}
 
-  // Hash Table
-  int h = hash(name);
-  s->next = hashTable[h];
-  hashTable[h] = s;
+Shard *stockShard(Stock *s) { return shardFor(symbolAt(s->id)->hash); }
 
-  // Structures
-  avlRoot = insertAVL(avlRoot, s);
+Stock *shardLookup(Shard *sh, uint32_t hash, const char *name) {
+  int id = htLookup(&sh->table, hash, name);
+  // Entries not yet migrated are still only reachable through the old table
+  if (id < 0)
+    id = htLookup(&sh->oldTable, hash, name);
+  return id < 0 ? NULL : stockRegistry[id];
+}
 
-  maxHeap[heapSize] = s;
-  s->maxHeapIdx = heapSize;
-  minHeap[heapSize] = s;
-  s->minHeapIdx = heapSize;
-  heapSize++;
-  updateHeaps(s); // Init sort
+// Room for 'needed' stocks in the shard's heaps and rank pool
+bool reserveShard(Shard *sh, int needed) {
+  if (needed + 1 > sh->rankCap) {
+    int cap = sh->rankCap ? sh->rankCap * 2 : INIT_STOCKS;
+    while (cap < needed + 1)
+      cap *= 2;
+    RankNode *p = (RankNode *)realloc(sh->rankPool, cap * sizeof(RankNode));
+    if (!p)
+      return false;
+    sh->rankPool = p;
+    sh->rankCap = cap;
+  }
+  if (needed <= sh->heapCap)
+    return true;
+  int cap = sh->heapCap ? sh->heapCap * 2 : INIT_STOCKS;
+  while (cap < needed)
+    cap *= 2;
+  HeapEntry *mx = (HeapEntry *)realloc(sh->maxHeap, cap * sizeof(HeapEntry));
+  if (!mx)
+    return false;
+  sh->maxHeap = mx;
+  HeapEntry *mn = (HeapEntry *)realloc(sh->minHeap, cap * sizeof(HeapEntry));
+  if (!mn)
+    return false;
+  sh->minHeap = mn;
+  Stock **os = (Stock **)realloc(sh->oversold.members, cap * sizeof(Stock *));
+  if (!os)
+    return false;
+  sh->oversold.members = os;
+  sh->heapCap = cap;
+  return true;
+}
 
-  insertTrie(name);
-  stockRegistry[registryCount++] = s;
+/* ================= DYNAMIC CAPACITY ================= */
+// Doubling keeps ADD amortized O(1) for the array part. The registry, the
+// hot columns and the symbol chunks are indexed the same way, so they grow
+// together.
+
+bool reserveStocks(int needed) {
+  if (needed <= stockCapacity)
+    return true;
+  int cap = stockCapacity ? stockCapacity : INIT_STOCKS;
+  while (cap < needed)
+    cap *= 2;
+  if (!reserveSymbols(cap))
+    return false;
 
-  logTransaction("BUY", name, buyPrice);
-  // printf("Stock %s added at %.2f\n", name, buyPrice);
+  Stock **reg = (Stock **)realloc(stockRegistry, cap * sizeof(Stock *));
+  if (!reg)
+    return false;
+  stockRegistry = reg;
+  int64_t *price = (int64_t *)realloc(hot.price, cap * sizeof(int64_t));
+  if (!price)
+    return false;
+  hot.price = price;
+  int64_t *buy = (int64_t *)realloc(hot.buy, cap * sizeof(int64_t));
+  if (!buy)
+    return false;
+  hot.buy = buy;
+  int *quantity = (int *)realloc(hot.quantity, cap * sizeof(int));
+  if (!quantity)
+    return false;
+  hot.quantity = quantity;
+  float *gain = (float *)realloc(hot.gain, cap * sizeof(float));
+  if (!gain)
+    return false;
+  hot.gain = gain;
+  int *mx = (int *)realloc(hot.maxHeapIdx, cap * sizeof(int));
+  if (!mx)
+    return false;
+  hot.maxHeapIdx = mx;
+  int *mn = (int *)realloc(hot.minHeapIdx, cap * sizeof(int));
+  if (!mn)
+    return false;
+  hot.minHeapIdx = mn;
+  stockCapacity = cap;
+  return true;
 }
 
-// Update Price (The most complex logic)
-void updateStockPrice(char *name, float newPrice, int newQty, bool isAuto) {
-  Stock *s = findStock(name);
-  if (!s) {
-    printf("Stock not found.\n");
-    return;
+/* ================= OVERSOLD SET ================= */
+// Every oversold stock counts as correlated with every other, so the risk
+// cluster is simply the union of the shards' oversold sets. Membership is
+// kept up to date on each tick (O(1)), which makes CLUSTERS a read of its
+// own output size. Capacity comes with the heaps (reserveShard).
+
+void oversoldTrack(Shard *sh, Stock *s) {
+  bool low = stockIndicators(sh, s)[SLOT_RSI14] < OVERSOLD_RSI;
+  OversoldSet *set = &sh->oversold;
+  if (low && s->oversoldIdx < 0) {
+    s->oversoldIdx = set->count;
+    set->members[set->count++] = s;
+  } else if (!low && s->oversoldIdx >= 0) {
+    Stock *last = set->members[--set->count];
+    set->members[s->oversoldIdx] = last;
+    last->oversoldIdx = s->oversoldIdx;
+    s->oversoldIdx = -1;
   }
+}
 
-  float oldPrice = s->priceHistory[(s->head - 1 + HISTORY_SIZE) % HISTORY_SIZE];
-
-  // 1. Logic for circular buffer overwrite
-  int currIdx = s->head;
-  float valToRemove = 0;
-  float gainToRemove = 0;
-  float lossToRemove = 0;
-
-  // If buffer full, we are overwriting the oldest value.
-  if (s->count == HISTORY_SIZE) {
-    valToRemove = s->priceHistory[currIdx];
-    bit_update(s->bit_price, currIdx, -valToRemove);
+int compareStockId(const void *a, const void *b) {
+  return (*(Stock *const *)a)->id - (*(Stock *const *)b)->id;
+}
 
-    // Remove old gain/loss contributions from BIT (Simplified approximation)
+// All oversold stocks in registry order (caller frees); NULL if none or
+// out of memory
+Stock **oversoldMembers(int *count) {
+  int n = 0;
+  for (int i = 0; i < shardCount; i++)
+    n += shards[i].oversold.count;
+  *count = n;
+  Stock **all = n ? (Stock **)malloc(n * sizeof(Stock *)) : NULL;
+  if (!all) {
+    *count = 0;
+    return NULL;
   }
+  n = 0;
+  for (int i = 0; i < shardCount; i++) {
+    OversoldSet *set = &shards[i].oversold;
+    memcpy(all + n, set->members, set->count * sizeof(Stock *));
+    n += set->count;
+  }
+  qsort(all, n, sizeof(Stock *), compareStockId);
+  return all;
+}
 
-  // Calculate new metrics
-  float change = newPrice - oldPrice;
-  float gain = (change > 0) ? change : 0;
-  float loss = (change < 0) ? -change : 0;
+/* ================= CORRELATION ================= */
+// Rolling Pearson correlation over the last CORR_WINDOW tick returns. A
+// stock with a full history ring gets a row: its returns centred and scaled
+// to unit length, so the correlation of two stocks is the dot product of
+// their rows. Rows are rebuilt only for stocks that ticked since, and all
+// pairs are computed tile by tile so both sides of a tile stay in cache.
+
+float *corrRows = NULL;     // CORR_STRIDE floats per slot
+CorrSlot *corrMeta = NULL;  // Per slot
+int *corrSlotOf = NULL;     // Per registry id, -1 without a slot
+int corrSlots = 0, corrSlotCap = 0, corrSlotOfCap = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+// Generic vectors: SSE/AVX or NEON, whatever the target offers
+typedef float CorrVec
+    __attribute__((vector_size(32), aligned(4), __may_alias__));
+#define CORR_LANES 8
+
+float corrSum(const CorrVec *v) {
+  return (((*v)[0] + (*v)[1]) + ((*v)[2] + (*v)[3])) +
+         (((*v)[4] + (*v)[5]) + ((*v)[6] + (*v)[7]));
+}
+#endif
+
+float corrDot(const float *a, const float *b) {
+#ifdef CORR_LANES
+  CorrVec acc = {0};
+  for (int k = 0; k < CORR_STRIDE; k += CORR_LANES)
+    acc += *(const CorrVec *)(a + k) * *(const CorrVec *)(b + k);
+  return corrSum(&acc);
+#else
+  float acc = 0;
+  for (int k = 0; k < CORR_STRIDE; k++)
+    acc += a[k] * b[k];
+  return acc;
+#endif
+}
 
-  // Update Price History & BIT
-  s->priceHistory[currIdx] = newPrice;
-  bit_update(s->bit_price, currIdx, newPrice);
+// Row a against the four consecutive rows at b: each load of a feeds four
+// multiply-adds
+void corrDot4(const float *a, const float *b, float out[4]) {
+#ifdef CORR_LANES
+  CorrVec acc0 = {0}, acc1 = {0}, acc2 = {0}, acc3 = {0};
+  for (int k = 0; k < CORR_STRIDE; k += CORR_LANES) {
+    CorrVec x = *(const CorrVec *)(a + k);
+    acc0 += x * *(const CorrVec *)(b + k);
+    acc1 += x * *(const CorrVec *)(b + CORR_STRIDE + k);
+    acc2 += x * *(const CorrVec *)(b + 2 * CORR_STRIDE + k);
+    acc3 += x * *(const CorrVec *)(b + 3 * CORR_STRIDE + k);
+  }
+  out[0] = corrSum(&acc0);
+  out[1] = corrSum(&acc1);
+  out[2] = corrSum(&acc2);
+  out[3] = corrSum(&acc3);
+#else
+  for (int q = 0; q < 4; q++)
+    out[q] = corrDot(a, b + q * CORR_STRIDE);
+#endif
+}
 
-  // Update Gain/Loss BITs
-  bit_update(s->bit_gain, currIdx, gain);
-  bit_update(s->bit_loss, currIdx, loss);
+float *corrRow(int slot) { return corrRows + (size_t)slot * CORR_STRIDE; }
+
+// Returns of the full history ring, centred and scaled to unit length
+void corrBuildRow(int slot) {
+  CorrSlot *c = &corrMeta[slot];
+  Stock *s = stockRegistry[c->stock];
+  double r[CORR_WINDOW], mean = 0, norm = 0;
+  int64_t prev = s->priceHistory[s->head]; // The ring is full: oldest tick
+  for (int k = 0; k < CORR_WINDOW; k++) {
+    int64_t price = s->priceHistory[(s->head + 1 + k) % HISTORY_SIZE];
+    r[k] = prev > 0 ? (double)(price - prev) / prev : 0;
+    prev = price;
+    mean += r[k];
+  }
+  mean /= CORR_WINDOW;
+  for (int k = 0; k < CORR_WINDOW; k++) {
+    r[k] -= mean;
+    norm += r[k] * r[k];
+  }
+  c->valid = norm > 1e-24;
+  double scale = c->valid ? 1.0 / sqrt(norm) : 0;
+  float *row = corrRow(slot);
+  for (int k = 0; k < CORR_STRIDE; k++)
+    row[k] = k < CORR_WINDOW ? (float)(r[k] * scale) : 0;
+  c->ticks = s->ticks;
+}
 
-  s->head = (s->head + 1) % HISTORY_SIZE;
+// Up-to-date row slot of a registry id; -1 without a full window (or
+// memory)
+int corrSlot(int id) {
+  Stock *s = stockRegistry[id];
   if (s->count < HISTORY_SIZE)
-    s->count++;
-
-  s->currentPrice = newPrice;
-  if (newQty > 0)
-    s->quantity = newQty;
-  if (newQty > 0)
-    s->quantity = newQty;
-
-  // Update Heaps
-  updateHeaps(s);
-
-  if (isAuto) {
-    // Silent update for test harness
-  } else {
-    // printf("Updated %s to %.2f. Change: %.2f\n", name, newPrice, change);
-    if (newPrice >= s->upperAlert) { /* Alert logic handled by frontend polling
-                                        or return data */
-    }
-    if (newPrice <= s->lowerAlert) { /* Alert logic */
+    return -1;
+  if (id >= corrSlotOfCap) {
+    int cap = corrSlotOfCap ? corrSlotOfCap : INIT_STOCKS;
+    while (cap <= id)
+      cap *= 2;
+    int *of = (int *)realloc(corrSlotOf, cap * sizeof(int));
+    if (!of)
+      return -1;
+    for (int i = corrSlotOfCap; i < cap; i++)
+      of[i] = -1;
+    corrSlotOf = of;
+    corrSlotOfCap = cap;
+  }
+  int slot = corrSlotOf[id];
+  if (slot < 0) {
+    if (corrSlots == corrSlotCap) {
+      int cap = corrSlotCap ? corrSlotCap * 2 : INIT_STOCKS;
+      float *rows =
+          (float *)realloc(corrRows, (size_t)cap * CORR_STRIDE * sizeof(float));
+      if (!rows)
+        return -1;
+      corrRows = rows;
+      CorrSlot *meta = (CorrSlot *)realloc(corrMeta, cap * sizeof(CorrSlot));
+      if (!meta)
+        return -1;
+      corrMeta = meta;
+      corrSlotCap = cap;
     }
+    slot = corrSlots++;
+    corrMeta[slot] = (CorrSlot){id, false, -1};
+    corrSlotOf[id] = slot;
   }
-
-  logTransaction("UPDATE", name, newPrice);
+  if (corrMeta[slot].ticks != s->ticks)
+    corrBuildRow(slot);
+  return slot;
 }
 
-/* ================= ANALYSIS ENGINE ================= */
-
-void analyzeIndicators() {
-  printf("\n%-10s | %-8s | %-8s | %-6s | %-15s\n", "STOCK", "PRICE", "SMA(5)",
-         "RSI(14)", "SIGNAL");
-  printf("---------------------------------------------------------------\n");
-
-  // Reset graph for this snapshot
-  memset(correlationGraph, 0, sizeof(correlationGraph));
-
-  for (int i = 0; i < registryCount; i++) {
-    Stock *s = stockRegistry[i];
-    float sma = calculateSMA(s, 5);
-    float rsi = calculateRSI(s, 14);
-
-    char signal[20] = "HOLD";
-
-    // Strategy: RSI Mean Reversion
-    if (rsi < 30)
-      strcpy(signal, "BUY (Oversold)");
-    else if (rsi > 70)
-      strcpy(signal, "SELL (Overbought)");
+// Bring the row of every stock with a full window up to date
+void corrSync() {
+  for (int i = 0; i < registryCount; i++)
+    corrSlot(i);
+}
 
-    // Build Correlation: Link stocks that are both Oversold
-    if (rsi < 30) {
-      for (int j = 0; j < registryCount; j++) {
-        if (i == j)
-          continue;
-        if (calculateRSI(stockRegistry[j], 14) < 30) {
-          correlationGraph[i][j] = 1;
-        }
-      }
+// Keep the 'limit' edges with the largest keys in a min-heap
+void corrKeep(CorrEdge *heap, int *n, int limit, CorrEdge e) {
+  int i;
+  if (*n < limit) {
+    i = (*n)++;
+    while (i > 0 && heap[(i - 1) / 2].key > e.key) {
+      heap[i] = heap[(i - 1) / 2];
+      i = (i - 1) / 2;
     }
-
-    printf("%-10s | %8.2f | %8.2f | %6.1f | %s\n", s->name, s->currentPrice,
-           sma, rsi, signal);
+    heap[i] = e;
+    return;
+  }
+  if (limit == 0 || e.key <= heap[0].key)
+    return;
+  i = 0; // Replace the smallest and sift down
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= *n)
+      break;
+    if (c + 1 < *n && heap[c + 1].key < heap[c].key)
+      c++;
+    if (heap[c].key >= e.key)
+      break;
+    heap[i] = heap[c];
+    i = c;
   }
+  heap[i] = e;
+}
 
-  printf("\n[Graph Analysis] Sector Risk Clusters (Correlated Oversold "
-         "Stocks):\n");
-  bool foundRisk = false;
-  bool visited[MAX_STOCKS] = {0};
+int compareEdgeDesc(const void *a, const void *b) {
+  float x = ((const CorrEdge *)a)->key, y = ((const CorrEdge *)b)->key;
+  return (x < y) - (x > y);
+}
 
-  for (int i = 0; i < registryCount; i++) {
-    if (!visited[i] && calculateRSI(stockRegistry[i], 14) < 30) {
-      bool cluster = false;
-      for (int j = 0; j < registryCount; j++) {
-        if (correlationGraph[i][j]) {
-          if (!cluster) {
-            printf("  Cluster: %s", stockRegistry[i]->name);
-            cluster = true;
-            visited[i] = true;
+// Every pair of valid rows with |corr| >= threshold, tile by tile. Returns
+// the number of such pairs; the strongest 'limit' are left in 'heap'.
+long corrPairs(float threshold, CorrEdge *heap, int *kept, int limit) {
+  corrSync();
+  int n = corrSlots;
+  long matched = 0;
+  *kept = 0;
+  for (int i0 = 0; i0 < n; i0 += CORR_TILE) {
+    int iEnd = i0 + CORR_TILE < n ? i0 + CORR_TILE : n;
+    for (int j0 = i0; j0 < n; j0 += CORR_TILE) {
+      int jEnd = j0 + CORR_TILE < n ? j0 + CORR_TILE : n;
+      for (int i = i0; i < iEnd; i++) {
+        if (!corrMeta[i].valid)
+          continue;
+        const float *a = corrRow(i);
+        int j = j0 == i0 ? i + 1 : j0;
+        while (j < jEnd) {
+          float r[4];
+          int m = jEnd - j < 4 ? 1 : 4;
+          if (m == 4)
+            corrDot4(a, corrRow(j), r);
+          else
+            r[0] = corrDot(a, corrRow(j));
+          for (int q = 0; q < m; q++, j++) {
+            if (!corrMeta[j].valid || fabsf(r[q]) < threshold)
+              continue;
+            matched++;
+            corrKeep(heap, kept, limit, (CorrEdge){i, j, r[q], fabsf(r[q])});
           }
-          printf(", %s", stockRegistry[j]->name);
-          visited[j] = true;
         }
       }
-      if (cluster) {
-        printf("\n");
-        foundRisk = true;
-      }
     }
   }
-  if (!foundRisk)
-    printf("  None detected.\n");
+  qsort(heap, *kept, sizeof(CorrEdge), compareEdgeDesc);
+  return matched;
 }
 
-/* ================= TEST HARNESS ================= */
-
-void runAutoTest() {
-  printf("\n=== RUNNING AUTOMATED TEST HARNESS ===\n");
-
-  // 1. Insert Stocks
-  addStock("RELIANCE", 2400.00, 10);
-  addStock("TCS", 3500.00, 5);
-  addStock("INFY", 1500.00, 20);
-
-  // 2. Simulate Price History for RELIANCE (Downtrend -> Oversold)
-  float rel_prices[] = {2380, 2350, 2300, 2250, 2200, 2150,
-                        2100, 2050, 2000, 1950, 1900, 1850};
-  for (int i = 0; i < 12; i++)
-    updateStockPrice("RELIANCE", rel_prices[i], 10, true);
-
-  // 3. Simulate Price History for TCS (Uptrend)
-  float tcs_prices[] = {3550, 3600, 3650, 3700, 3750, 3800, 3850, 3900};
-  for (int i = 0; i < 8; i++)
-    updateStockPrice("TCS", tcs_prices[i], 5, true);
-
-  // 4. Simulate Price History for INFY (Correlation with RELIANCE - also
-  // crashing)
-  float infy_prices[] = {1480, 1450, 1400, 1350, 1300, 1250, 1200, 1150, 1100};
-  for (int i = 0; i < 9; i++)
-    updateStockPrice("INFY", infy_prices[i], 20, true);
+// The 'limit' rows most positively correlated with 'slot', best first
+int corrTop(int slot, CorrEdge *heap, int limit) {
+  corrSync();
+  int kept = 0;
+  const float *a = corrRow(slot);
+  for (int j = 0; j < corrSlots; j++) {
+    if (j == slot || !corrMeta[j].valid)
+      continue;
+    float r = corrDot(a, corrRow(j));
+    corrKeep(heap, &kept, limit, (CorrEdge){slot, j, r, r});
+  }
+  qsort(heap, kept, sizeof(CorrEdge), compareEdgeDesc);
+  return kept;
+}
 
-  // 5. Verify Structures
-  printf("\n[Validation] Top Gainer: %s (%.2f%%)\n", maxHeap[0]->name,
-         getPercent(maxHeap[0]));
-  printf("[Validation] Top Loser:  %s (%.2f%%)\n", minHeap[0]->name,
-         getPercent(minHeap[0]));
+float corrClamp(float r) { return r > 1 ? 1 : r < -1 ? -1 : r; }
 
-  printf("\n[Validation] Trie Search 'TCS': %s\n",
-         searchTrie("TCS") ? "FOUND" : "FAIL");
-  printf("[Validation] Trie Search 'XYZ': %s\n",
-         searchTrie("XYZ") ? "FOUND" : "NOT FOUND (Correct)");
+/* ================= TRIE ================= */
+// Radix trie: insert and exact lookup are O(L). Every inner node branches
+// or ends a symbol, so listing k symbols under a prefix visits
+// O(prefix + k) nodes.
 
-  // 6. Run Analysis
-  analyzeIndicators();
-  printf("\n=== TEST COMPLETE ===\n");
+const char *trieLabel(const TrieNode *n) {
+  return symbolName(n->stock) + n->depth - n->len;
 }
 
-/* ================= API MODE ================= */
-
-// Helper to sanitize float printing to JSON
-void printFloat(float f) {
-  if (isnan(f))
-    printf("null");
-  else
-    printf("%.2f", f);
+// Index of the new node, or -1 when out of memory
+int trieNewNode(int stock, int depth, int len, int end) {
+  if (trieCount == trieCap) {
+    int cap = trieCap ? trieCap * 2 : INIT_STOCKS;
+    TrieNode *p = (TrieNode *)realloc(triePool, cap * sizeof(TrieNode));
+    if (!p)
+      return -1;
+    triePool = p;
+    trieCap = cap;
+  }
+  triePool[trieCount] = (TrieNode){0, 0, stock, end, (uint8_t)depth,
+                                  (uint8_t)len,
+                                  symbolName(stock)[depth - len]};
+  return trieCount++;
 }
 
-// Print single stock object as JSON
-void printStockJSON(Stock *s, bool last) {
-  float gain = getPercent(s);
-  float sma = calculateSMA(s, 5);
-  float rsi = calculateRSI(s, 14);
+bool insertTrie(int id) {
+  if (trieCount == 0 && trieNewNode(id, 0, 0, -1) < 0)
+    return false;
+  const char *name = symbolName(id);
+  int len = (int)strlen(name);
+  int node = 0, depth = 0;
+  while (depth < len) {
+    unsigned char c = (unsigned char)name[depth];
+    int prev = 0, child = triePool[node].child;
+    while (child && (unsigned char)triePool[child].first < c) {
+      prev = child;
+      child = triePool[child].next;
+    }
+    if (!child || (unsigned char)triePool[child].first != c) {
+      // New leaf holding the rest of the name
+      int leaf = trieNewNode(id, len, len - depth, id);
+      if (leaf < 0)
+        return false;
+      triePool[leaf].next = child;
+      if (prev)
+        triePool[prev].next = leaf;
+      else
+        triePool[node].child = leaf;
+      return true;
+    }
+    const char *label = trieLabel(&triePool[child]);
+    int n = triePool[child].len, k = 1;
+    while (k < n && label[k] == name[depth + k])
+      k++;
+    if (k < n) {
+      // Split the edge: a new node takes the common part of the label
+      int mid = trieNewNode(triePool[child].stock, depth + k, k, -1);
+      if (mid < 0)
+        return false;
+      triePool[mid].child = child;
+      triePool[mid].next = triePool[child].next;
+      triePool[child].next = 0;
+      triePool[child].len = (uint8_t)(n - k);
+      triePool[child].first = label[k];
+      if (prev)
+        triePool[prev].next = mid;
+      else
+        triePool[node].child = mid;
+      child = mid;
+    }
+    node = child;
+    depth += k;
+  }
+  triePool[node].end = id;
+  return true;
+}
 
-  printf("{\"name\": \"%s\", \"buyPrice\": %.2f, \"currentPrice\": %.2f, "
-         "\"quantity\": %d, \"percentGain\": %.2f, \"sma\": %.2f, \"rsi\": "
-         "%.2f, \"upperAlert\": %.2f, \"lowerAlert\": %.2f}%s",
-         s->name, s->buyPrice, s->currentPrice, s->quantity, gain, sma, rsi,
-         s->upperAlert, s->lowerAlert, last ? "" : ",");
+// Symbols are indexed on first use, so ADD and image loads skip the trie
+bool trieSync() {
+  for (; trieIndexed < registryCount; trieIndexed++)
+    if (!insertTrie(trieIndexed))
+      return false;
+  return true;
 }
 
-void apiRecursiveAVL(AVL *root, bool *isFirst) {
-  if (root) {
-    apiRecursiveAVL(root->left, isFirst);
-    if (!*isFirst)
-      printf(",");
-    printStockJSON(root->stock, true);
-    *isFirst = false;
-    apiRecursiveAVL(root->right, isFirst);
+// Highest node whose path starts with 'prefix', or -1 if no symbol does
+int trieFind(const char *prefix) {
+  if (!trieSync() || trieCount == 0)
+    return -1;
+  int len = (int)strlen(prefix);
+  int node = 0, depth = 0;
+  while (depth < len) {
+    int child = triePool[node].child;
+    while (child && triePool[child].first != prefix[depth])
+      child = triePool[child].next;
+    if (!child)
+      return -1;
+    const char *label = trieLabel(&triePool[child]);
+    for (int k = 1; k < triePool[child].len && depth + k < len; k++)
+      if (label[k] != prefix[depth + k])
+        return -1;
+    node = child;
+    depth += triePool[child].len;
   }
+  return node;
 }
 
-// Helper to print all stocks using In-Order Traversal (Sorted by Name in this
-// impl, but effectively all stocks)
-void cmdStocks() {
-  printf("[");
-  bool isFirst = true;
-  apiRecursiveAVL(avlRoot, &isFirst);
-  printf("]\n");
+bool searchTrie(const char *word) {
+  int node = trieFind(word);
+  return node >= 0 && triePool[node].depth == strlen(word) &&
+         triePool[node].end >= 0;
 }
 
-void cmdTop() {
-  printf("{");
-  if (heapSize > 0) {
-    printf("\"topGainer\": ");
-    printStockJSON(maxHeap[0], true);
-    printf(", \"topLoser\": ");
-    printStockJSON(minHeap[0], true);
-  } else {
-    printf("\"topGainer\": null, \"topLoser\": null");
+// Visit the symbols under 'node' in byte order while *left > 0
+void trieWalk(int node, int *left, void (*visit)(Stock *, void *), void *ctx) {
+  if (triePool[node].end >= 0) {
+    visit(stockRegistry[triePool[node].end], ctx);
+    if (--*left == 0)
+      return;
   }
-  printf("}\n");
+  for (int c = triePool[node].child; c && *left > 0; c = triePool[c].next)
+    trieWalk(c, left, visit, ctx);
 }
 
-void cmdSummary() {
-  float totalInvest = 0;
-  float currentValue = 0;
+/* ================= ORDER-STATISTIC TREE ================= */
+// AVL keyed by (percentGain ascending, id descending) and augmented with
+// subtree sizes. Read backwards the tree is the ranking, with equal gains
+// in id order as the heaps break them, so TOP, TOPK, RANK and PERCENTILE
+// agree on ties. Insert/delete/rank/select are O(log N); top-k walks are
+// O(log N + k).
+// A stock is repositioned (delete + reinsert of the same node) whenever
+// its gain changes, so no allocation happens on the update path.
+
+int rankHeight(Shard *sh, int n) { return n ? sh->rankPool[n].height : 0; }
+int rankSize(Shard *sh, int n) { return n ? sh->rankPool[n].size : 0; }
+
+void rankFix(Shard *sh, int n) {
+  RankNode *x = &sh->rankPool[n];
+  x->height = 1 + max_i(rankHeight(sh, x->left), rankHeight(sh, x->right));
+  x->size = 1 + rankSize(sh, x->left) + rankSize(sh, x->right);
+}
 
-  for (int i = 0; i < registryCount; i++) {
-    Stock *s = stockRegistry[i];
-    totalInvest += s->buyPrice * s->quantity;
-    currentValue += s->currentPrice * s->quantity;
-  }
+int rankRotateRight(Shard *sh, int y) {
+  RankNode *p = sh->rankPool;
+  int x = p[y].left;
+  p[y].left = p[x].right;
+  p[x].right = y;
+  rankFix(sh, y);
+  rankFix(sh, x);
+  return x;
+}
 
-  printf("{\"totalInvestment\": %.2f, \"currentValue\": %.2f, \"profit\": "
-         "%.2f, \"stockCount\": %d}\n",
-         totalInvest, currentValue, currentValue - totalInvest, registryCount);
+int rankRotateLeft(Shard *sh, int x) {
+  RankNode *p = sh->rankPool;
+  int y = p[x].right;
+  p[x].right = p[y].left;
+  p[y].left = x;
+  rankFix(sh, x);
+  rankFix(sh, y);
+  return y;
 }
 
-void cmdTrends(char *name) {
-  Stock *s = findStock(name);
-  if (!s) {
-    printf("{\"error\": \"Stock not found\"}\n");
-    return;
+int rankBalance(Shard *sh, int n) {
+  RankNode *p = sh->rankPool;
+  rankFix(sh, n);
+  int balance = rankHeight(sh, p[n].left) - rankHeight(sh, p[n].right);
+  if (balance > 1) {
+    int l = p[n].left;
+    if (rankHeight(sh, p[l].left) < rankHeight(sh, p[l].right))
+      p[n].left = rankRotateLeft(sh, l);
+    return rankRotateRight(sh, n);
+  }
+  if (balance < -1) {
+    int r = p[n].right;
+    if (rankHeight(sh, p[r].right) < rankHeight(sh, p[r].left))
+      p[n].right = rankRotateRight(sh, r);
+    return rankRotateLeft(sh, n);
   }
+  return n;
+}
 
-  float sma = calculateSMA(s, 5);
-  float rsi = calculateRSI(s, 14);
-  char signal[50] = "HOLD";
-  char confidence[10] = "MEDIUM";
+// Order: ascending gain, ties by descending stock id
+int rankCompare(Shard *sh, float key, int stock, int n) {
+  RankNode *x = &sh->rankPool[n];
+  if (key < x->key)
+    return -1;
+  if (key > x->key)
+    return 1;
+  return (stock < x->stock) - (stock > x->stock);
+}
 
-  if (rsi < 30) {
-    strcpy(signal, "BUY (Oversold)");
-    strcpy(confidence, "HIGH");
-  } else if (rsi > 70) {
-    strcpy(signal, "SELL (Overbought)");
-    strcpy(confidence, "HIGH");
+int rankInsert(Shard *sh, int root, int n) {
+  RankNode *p = sh->rankPool;
+  if (!root) {
+    p[n].left = p[n].right = 0;
+    rankFix(sh, n);
+    return n;
   }
+  if (rankCompare(sh, p[n].key, p[n].stock, root) < 0)
+    p[root].left = rankInsert(sh, p[root].left, n);
+  else
+    p[root].right = rankInsert(sh, p[root].right, n);
+  return rankBalance(sh, root);
+}
 
-  printf("{\"name\": \"%s\", \"sma\": %.2f, \"rsi\": %.2f, \"recommendation\": "
-         "\"%s\", \"confidence\": \"%s\"}\n",
-         s->name, sma, rsi, signal, confidence);
+int rankDetachMin(Shard *sh, int root, int *min) {
+  RankNode *p = sh->rankPool;
+  if (!p[root].left) {
+    *min = root;
+    return p[root].right;
+  }
+  p[root].left = rankDetachMin(sh, p[root].left, min);
+  return rankBalance(sh, root);
 }
 
-void cmdTransactions() {
-  printf("[");
-  Transaction *t = transHead;
-  int count = 0;
-  while (t && count < 50) { // Limit to last 50
-    if (count > 0)
-      printf(",");
-    printf("{\"type\": \"%s\", \"symbol\": \"%s\", \"price\": %.2f}", t->type,
-           t->symbol, t->price);
-    t = t->next;
-    count++;
+// Unlink node 'n' from the tree (its pool slot stays reserved)
+int rankDelete(Shard *sh, int root, int n) {
+  if (!root)
+    return 0;
+  RankNode *p = sh->rankPool;
+  int cmp = rankCompare(sh, p[n].key, p[n].stock, root);
+  if (cmp < 0) {
+    p[root].left = rankDelete(sh, p[root].left, n);
+  } else if (cmp > 0) {
+    p[root].right = rankDelete(sh, p[root].right, n);
+  } else {
+    if (!p[root].left || !p[root].right)
+      return p[root].left ? p[root].left : p[root].right;
+    int succ;
+    int right = rankDetachMin(sh, p[root].right, &succ);
+    p[succ].left = p[root].left;
+    p[succ].right = right;
+    return rankBalance(sh, succ);
   }
-  printf("]\n");
+  return rankBalance(sh, root);
 }
 
-void cmdClusters() {
-  // 1. Recalculate RSI and build graph (same logic as analyzeIndicators)
-  memset(correlationGraph, 0, sizeof(correlationGraph));
+// Move a stock to the position matching its current gain
+void rankReposition(Shard *sh, Stock *s) {
+  float gain = getPercent(s);
+  if (sh->rankPool[s->rankIdx].key == gain)
+    return;
+  sh->rankRoot = rankDelete(sh, sh->rankRoot, s->rankIdx);
+  sh->rankPool[s->rankIdx].key = gain;
+  sh->rankRoot = rankInsert(sh, sh->rankRoot, s->rankIdx);
+}
+
+// Number of nodes in one tree ordered strictly before (key, stock)
+int rankCountBefore(Shard *sh, float key, int stock) {
+  int idx = 0;
+  int n = sh->rankRoot;
+  while (n) {
+    if (rankCompare(sh, key, stock, n) <= 0) {
+      n = sh->rankPool[n].left;
+    } else {
+      idx += rankSize(sh, sh->rankPool[n].left) + 1;
+      n = sh->rankPool[n].right;
+    }
+  }
+  return idx;
+}
+
+// Node of the k-th smallest (0-based) within one tree
+int rankSelectIn(Shard *sh, int k) {
+  int n = sh->rankRoot;
+  while (n) {
+    int leftSize = rankSize(sh, sh->rankPool[n].left);
+    if (k < leftSize) {
+      n = sh->rankPool[n].left;
+    } else if (k > leftSize) {
+      k -= leftSize + 1;
+      n = sh->rankPool[n].right;
+    } else {
+      return n;
+    }
+  }
+  return 0;
+}
+
+// Number of stocks, over all shards, ordered strictly before 's'
+int rankIndexOf(Stock *s) {
+  float key = stockShard(s)->rankPool[s->rankIdx].key;
+  int idx = 0;
+  for (int i = 0; i < shardCount; i++)
+    idx += rankCountBefore(&shards[i], key, s->id);
+  return idx;
+}
+
+// k-th smallest (0-based) over all shards. Each round takes the middle of
+// the widest remaining index range, counts the keys before it in every
+// shard, and narrows all ranges to the side holding k: O(S^2 log^2 N).
+Stock *rankSelect(int k) {
+  if (shardCount == 1) {
+    int n = rankSelectIn(&shards[0], k);
+    return n ? stockRegistry[shards[0].rankPool[n].stock] : NULL;
+  }
+  int lo[MAX_SHARDS], hi[MAX_SHARDS], before[MAX_SHARDS];
+  for (int i = 0; i < shardCount; i++) {
+    lo[i] = 0;
+    hi[i] = rankSize(&shards[i], shards[i].rankRoot);
+  }
+  for (;;) {
+    int w = -1;
+    for (int i = 0; i < shardCount; i++)
+      if (hi[i] > lo[i] && (w < 0 || hi[i] - lo[i] > hi[w] - lo[w]))
+        w = i;
+    if (w < 0)
+      return NULL; // k out of range
+    int m = lo[w] + (hi[w] - lo[w]) / 2;
+    RankNode *c = &shards[w].rankPool[rankSelectIn(&shards[w], m)];
+    int r = 0;
+    for (int i = 0; i < shardCount; i++) {
+      before[i] = i == w ? m : rankCountBefore(&shards[i], c->key, c->stock);
+      r += before[i];
+    }
+    if (r == k)
+      return stockRegistry[c->stock];
+    for (int i = 0; i < shardCount; i++) {
+      if (r < k)
+        lo[i] = max_i(lo[i], before[i] + (i == w));
+      else if (before[i] < hi[i])
+        hi[i] = before[i];
+    }
+  }
+}
+
+// A cursor always steps backwards through the tree. A descending walk does
+// that from the end; an ascending one takes each run of equal gains
+// backwards, so there too the lowest id comes first.
+void rankCursorDescend(RankCursor *c, int n) {
+  while (n) {
+    c->stack[c->top++] = n;
+    n = c->sh->rankPool[n].right;
+  }
+}
+
+// Park an ascending cursor on the last node of the smallest gain above
+// 'key' (of the smallest gain if 'first'); empty if there is none
+void rankCursorNextRun(RankCursor *c, float key, bool first) {
+  RankNode *p = c->sh->rankPool;
+  int run = 0;
+  for (int n = c->sh->rankRoot; n;)
+    if (first || p[n].key > key) {
+      run = n;
+      n = p[n].left;
+    } else {
+      n = p[n].right;
+    }
+  c->top = 0;
+  for (int n = run ? c->sh->rankRoot : 0; n;)
+    if (p[n].key <= p[run].key) {
+      c->stack[c->top++] = n;
+      n = p[n].right;
+    } else {
+      n = p[n].left;
+    }
+}
+
+RankNode *rankCursorNext(RankCursor *c) {
+  RankNode *n = &c->sh->rankPool[c->stack[--c->top]];
+  rankCursorDescend(c, n->left);
+  if (!c->descending &&
+      (!c->top || c->sh->rankPool[c->stack[c->top - 1]].key != n->key))
+    rankCursorNextRun(c, n->key, false);
+  return n;
+}
+
+// True if 'a' comes before 'b' in a walk: the higher (or lower) gain
+// first, equal gains in id order
+bool rankWalkBefore(RankNode *a, RankNode *b, bool descending) {
+  if (a->key != b->key)
+    return descending ? a->key > b->key : a->key < b->key;
+  return a->stock < b->stock;
+}
+
+// Visit up to 'limit' stocks in ascending (or descending) gain order,
+// merging the shards' trees one head at a time.
+void rankWalk(bool descending, int limit, void (*visit)(Stock *, void *),
+              void *ctx) {
+  RankCursor cur[MAX_SHARDS];
+  for (int i = 0; i < shardCount; i++) {
+    cur[i].sh = &shards[i];
+    cur[i].top = 0;
+    cur[i].descending = descending;
+    if (descending)
+      rankCursorDescend(&cur[i], shards[i].rankRoot);
+    else
+      rankCursorNextRun(&cur[i], 0, true);
+  }
+  while (limit-- > 0) {
+    int best = -1;
+    for (int i = 0; i < shardCount; i++) {
+      if (!cur[i].top)
+        continue;
+      if (best < 0) {
+        best = i;
+        continue;
+      }
+      RankNode *n = &shards[i].rankPool[cur[i].stack[cur[i].top - 1]];
+      RankNode *b = &shards[best].rankPool[cur[best].stack[cur[best].top - 1]];
+      if (rankWalkBefore(n, b, descending))
+        best = i;
+    }
+    if (best < 0)
+      break;
+    visit(stockRegistry[rankCursorNext(&cur[best])->stock], ctx);
+  }
+}
+
+void printRankLine(Stock *s, void *ctx) {
+  (void)ctx;
+  printf("  %-10s | %6.2f%%\n", symbolName(s->id), getPercent(s));
+}
+
+/* ================= HEAPS (Max & Min) ================= */
+// 4-ary heaps of {key, id} entries, with the stocks' positions in the hot
+// columns. A node's four children share one 32-byte run, and keys are read
+// from the entries, so a re-key does no division and touches no Stock.
+// Ties go to the lower id. Operations O(log4 N)
+
+// The entry order as one integer: the key's bits made monotonic (-0 counts
+// as 0), then the inverted id. Comparisons compile without branches.
+uint64_t heapRank(HeapEntry e) {
+  float key = e.key + 0.0f;
+  uint32_t k;
+  memcpy(&k, &key, sizeof(k));
+  k ^= (uint32_t)((int32_t)k >> 31) | 0x80000000u;
+  return (uint64_t)k << 32 | (uint32_t)~e.id;
+}
+
+bool heapAbove(HeapEntry a, HeapEntry b) { return heapRank(a) > heapRank(b); }
+
+// Move entry i towards the root while it belongs above its parent. An
+// entry that stays put writes nothing.
+void heapSiftUp(HeapEntry *h, int *pos, int i) {
+  HeapEntry e = h[i];
+  int start = i;
+  while (i > 0) {
+    int p = (i - 1) / HEAP_ARITY;
+    if (!heapAbove(e, h[p]))
+      break;
+    h[i] = h[p];
+    pos[h[i].id] = i;
+    i = p;
+  }
+  if (i != start) {
+    h[i] = e;
+    pos[e.id] = i;
+  }
+}
+
+// Move entry i towards the leaves while a child belongs above it
+void heapSiftDown(HeapEntry *h, int *pos, int n, int i) {
+  HeapEntry e = h[i];
+  int start = i;
+  for (;;) {
+    int first = HEAP_ARITY * i + 1;
+    if (first >= n)
+      break;
+    int end = min_i(first + HEAP_ARITY, n);
+    int best = first;
+    uint64_t bestRank = heapRank(h[first]);
+    for (int c = first + 1; c < end; c++) {
+      uint64_t r = heapRank(h[c]);
+      best = r > bestRank ? c : best;
+      bestRank = r > bestRank ? r : bestRank;
+    }
+    if (bestRank <= heapRank(e))
+      break;
+    h[i] = h[best];
+    pos[h[i].id] = i;
+    i = best;
+  }
+  if (i != start) {
+    h[i] = e;
+    pos[e.id] = i;
+  }
+}
+
+// Change a stock's key and move it up or down accordingly
+void heapRekey(HeapEntry *h, int *pos, int n, int id, float key) {
+  int i = pos[id];
+  bool up = key > h[i].key;
+  h[i].key = key;
+  if (up)
+    heapSiftUp(h, pos, i);
+  else
+    heapSiftDown(h, pos, n, i);
+}
+
+// Append a stock to both heaps of its shard (capacity must be reserved)
+void heapInsert(Shard *sh, int id) {
+  int i = sh->heapSize++;
+  sh->maxHeap[i] = (HeapEntry){hot.gain[id], id};
+  sh->minHeap[i] = (HeapEntry){-hot.gain[id], id};
+  hot.maxHeapIdx[id] = hot.minHeapIdx[id] = i;
+  heapSiftUp(sh->maxHeap, hot.maxHeapIdx, i);
+  heapSiftUp(sh->minHeap, hot.minHeapIdx, i);
+}
+
+// Reorder a stock whose gain changed
+void updateHeaps(Shard *sh, int id) {
+  float gain = hot.gain[id];
+  heapRekey(sh->maxHeap, hot.maxHeapIdx, sh->heapSize, id, gain);
+  heapRekey(sh->minHeap, hot.minHeapIdx, sh->heapSize, id, -gain);
+}
+
+// Global extremes: the best of the shards' heap roots (NULL when empty)
+Stock *topGainer() {
+  HeapEntry *best = NULL;
+  for (int i = 0; i < shardCount; i++)
+    if (shards[i].heapSize > 0 &&
+        (!best || heapAbove(shards[i].maxHeap[0], *best)))
+      best = &shards[i].maxHeap[0];
+  return best ? stockRegistry[best->id] : NULL;
+}
+
+Stock *topLoser() {
+  HeapEntry *worst = NULL;
+  for (int i = 0; i < shardCount; i++)
+    if (shards[i].heapSize > 0 &&
+        (!worst || heapAbove(shards[i].minHeap[0], *worst)))
+      worst = &shards[i].minHeap[0];
+  return worst ? stockRegistry[worst->id] : NULL;
+}
+
+/* ================= CORE LOGIC ================= */
+
+Stock *findStock(char *name) {
+  uint32_t h = hashSymbol(name);
+  return shardLookup(shardFor(h), h, name);
+}
+
+float getPercent(Stock *s) { return hot.gain[s->id]; }
+
+// Price and the gain derived from it always change together
+void setPrice(int id, int64_t price) {
+  int64_t buy = hot.buy[id];
+  hot.price[id] = price;
+  hot.gain[id] = buy == 0 ? 0 : (float)((double)(price - buy) / buy * 100.0);
+}
+
+// CALCULATE SMA over the trailing window (O(1))
+float calculateSMA(Stock *s, int period) {
+  if (s->count < period)
+    period = s->count; // Fallback
+  if (period <= 0)
+    return (float)priceValue(hot.price[s->id]);
+  return (float)(priceValue(windowSum(s->cumPrice, s, period)) / period);
+}
+
+// CALCULATE RSI from windowed gain/loss sums (O(1))
+float calculateRSI(Stock *s, int period) {
+  if (period <= 0 || s->count < period + 1)
+    return 50.0; // Needs period + 1 points for 'period' changes
+
+  double avgGain = (double)windowSum(s->cumGain, s, period) / period;
+  double avgLoss = (double)windowSum(s->cumLoss, s, period) / period;
+
+  if (avgLoss == 0)
+    return 100.0;
+  double rs = avgGain / avgLoss;
+  return (float)(100.0 - (100.0 / (1.0 + rs)));
+}
+
+/* ================= INDICATOR REGISTRY ================= */
+
+void indicatorLabel(IndicatorSpec *spec, char *out) {
+  sprintf(out, "%s%d", spec->type == IND_SMA ? "SMA" : "RSI", spec->period);
+}
+
+// Recompute every registered indicator for one stock in a single pass
+void refreshIndicators(Stock *s) {
+  for (int i = 0; i < indicatorCount; i++) {
+    IndicatorSpec *spec = &indicatorSpecs[i];
+    s->indicators[i] = spec->type == IND_SMA ? calculateSMA(s, spec->period)
+                                             : calculateRSI(s, spec->period);
+  }
+  s->indicatorsStale = false;
+}
+
+// The stock's indicator values, refreshed first if it ticked since the last
+// read. Counted on the stock's shard, so shard workers can call it.
+const float *stockIndicators(Shard *sh, Stock *s) {
+  if (s->indicatorsStale) {
+    refreshIndicators(s);
+    sh->indicatorMisses++;
+  } else {
+    sh->indicatorHits++;
+  }
+  return s->indicators;
+}
+
+// Returns the slot of the (possibly already registered) indicator, or -1
+int registerIndicator(IndicatorType type, int period) {
+  int maxPeriod = type == IND_SMA ? HISTORY_SIZE : HISTORY_SIZE - 1;
+  if (period < 1 || period > maxPeriod)
+    return -1;
+  for (int i = 0; i < indicatorCount; i++)
+    if (indicatorSpecs[i].type == type && indicatorSpecs[i].period == period)
+      return i;
+  if (indicatorCount == MAX_INDICATORS)
+    return -1;
+
+  int slot = indicatorCount++;
+  indicatorSpecs[slot].type = type;
+  indicatorSpecs[slot].period = period;
+  walLog(WAL_INDICATOR, type == IND_SMA ? "SMA" : "RSI", 0, period);
+  for (int i = 0; i < registryCount; i++) {
+    Stock *s = stockRegistry[i];
+    s->indicators[slot] = type == IND_SMA ? calculateSMA(s, period)
+                                          : calculateRSI(s, period);
+  }
+  return slot;
+}
+
+// Segment for the next entry: a fresh one until the shard reaches its
+// retention limit, then the oldest one is recycled. NULL if out of memory.
+LogSegment *logNextSegment(TransactionLog *log, SlabPool *pool) {
+  LogSegment *seg;
+  if (log->segments >= logMaxSegments && log->oldest != log->newest) {
+    seg = log->oldest;
+    log->oldest = seg->newer;
+    log->oldest->older = NULL;
+    log->dropped += seg->count;
+  } else {
+    seg = (LogSegment *)poolAlloc(pool);
+    if (!seg)
+      return NULL;
+    log->segments++;
+  }
+  seg->count = 0;
+  seg->older = log->newest;
+  seg->newer = NULL;
+  if (log->newest)
+    log->newest->newer = seg;
+  else
+    log->oldest = seg;
+  log->newest = seg;
+  return seg;
+}
+
+const char *txTypeName(int type) {
+  static const char *const names[TX_TYPES] = {"BUY", "SELL", "UPDATE"};
+  return type >= 0 && type < TX_TYPES ? names[type] : "UNKNOWN";
+}
+
+// Add Transaction Log (per shard; 'seq' orders entries across shards)
+void logTransaction(Shard *sh, TxType type, int stock, int64_t price,
+                    unsigned long seq) {
+  LogSegment *seg = sh->log.newest;
+  if (!seg || seg->count == LOG_SEGMENT_ENTRIES) {
+    seg = logNextSegment(&sh->log, &sh->segments);
+    if (!seg)
+      return; // The log is best effort; the tick itself still applies
+  }
+  Transaction *t = &seg->entries[seg->count++];
+  t->seq = seq;
+  t->stock = stock;
+  t->price = price;
+  t->type = (uint8_t)type;
+}
+
+// Create Stock
+Status addStock(char *name, int64_t buyPrice, int qty) {
+  size_t len = strlen(name);
+  if (len == 0 || len >= NAME_LEN)
+    return ST_BAD_SYMBOL;
+  uint32_t h = hashSymbol(name);
+  Shard *sh = shardFor(h);
+  if (shardLookup(sh, h, name))
+    return ST_EXISTS;
+  if (!reserveStocks(registryCount + 1) || !reserveShard(sh, sh->heapSize + 1))
+    return ST_NO_MEMORY;
+
+  Stock *s = (Stock *)poolAlloc(&stockPool);
+  if (!s)
+    return ST_NO_MEMORY;
+  memset(s, 0, sizeof(Stock));
+  int id = registryCount; // Assigned by linkStock
+  symbolIntern(id, name, h);
+  hot.buy[id] = buyPrice;
+  hot.quantity[id] = qty;
+  setPrice(id, buyPrice);
+  s->upperAlert = buyPrice + buyPrice / 10; // +/-10%, truncated to a tick
+  s->lowerAlert = buyPrice - buyPrice / 10;
+
+  // Init History with the purchase price
+  windowPush(s, buyPrice);
+  s->indicatorsStale = true;
+  linkStock(sh, h, s);
+
+  logTransaction(sh, TX_BUY, id, buyPrice, transSeq++);
+  snapMarkDirty(sh, s);
+  walLog(WAL_ADD, name, buyPrice, qty);
+  return ST_OK;
+}
+
+// Index a new stock in its shard and the global structures (capacity for
+// the registry and heaps must already be reserved)
+void linkStock(Shard *sh, uint32_t h, Stock *s) {
+  // Hash Table
+  s->id = registryCount;
+  htInsert(sh, h, s->id);
+  stockRegistry[registryCount++] = s;
+
+  // Structures
+  if (sh->rankCount == 0)
+    sh->rankCount = 1; // Slot 0 stands for "no node"
+  s->rankIdx = sh->rankCount++;
+  sh->rankPool[s->rankIdx].key = getPercent(s);
+  sh->rankPool[s->rankIdx].stock = s->id;
+  sh->rankRoot = rankInsert(sh, sh->rankRoot, s->rankIdx);
+
+  heapInsert(sh, s->id);
+
+  s->oversoldIdx = -1;
+  oversoldTrack(sh, s);
+}
+
+// Per-tick state change shared by UPDATE and UPDATEBATCH. Touches only the
+// stock and its shard's log; ordering structures are left to the caller.
+void applyTick(Shard *sh, Stock *s, int64_t newPrice, int newQty,
+               unsigned long seq) {
+  // 1. Circular buffer + window sums (the oldest tick drops out implicitly)
+  windowPush(s, newPrice);
+
+  setPrice(s->id, newPrice);
+  if (newQty > 0)
+    hot.quantity[s->id] = newQty;
+
+  // 2. Indicators are recomputed on the next read
+  s->indicatorsStale = true;
+
+  logTransaction(sh, TX_UPDATE, s->id, newPrice, seq);
+  snapMarkDirty(sh, s);
+}
+
+// Update Price (The most complex logic)
+Status updateStockPrice(const char *name, int64_t newPrice, int newQty,
+                        bool isAuto) {
+  uint32_t h = hashSymbol(name);
+  Shard *sh = shardFor(h);
+  Stock *s = shardLookup(sh, h, name);
+  if (!s)
+    return ST_NOT_FOUND;
+
+  applyTick(sh, s, newPrice, newQty, transSeq++);
+  walLog(WAL_UPDATE, name, newPrice, newQty);
+
+  // 3. Update Heaps, gain ranking and oversold set
+  updateHeaps(sh, s->id);
+  rankReposition(sh, s);
+  oversoldTrack(sh, s);
+
+  if (isAuto) {
+    // Silent update for test harness
+  } else {
+    // printf("Updated %s to %.2f. Change: %.2f\n", name, newPrice, change);
+    if (newPrice >= s->upperAlert) { /* Alert logic handled by frontend polling
+                                        or return data */
+    }
+    if (newPrice <= s->lowerAlert) { /* Alert logic */
+    }
+  }
+  return ST_OK;
+}
+
+/* ================= BATCHED UPDATES ================= */
+// A batch applies every tick immediately but reorders each touched stock
+// only once at the end. When a large share of the universe moved, the heaps
+// are rebuilt bottom-up in O(N) instead of sifting each stock.
+// Ticks are first queued per shard (batchQueue); batchApply then runs every
+// shard's slice on its own worker, so shards never contend for anything.
+
+bool batchTick(Shard *sh, BatchTick *t) {
+  Stock *s = shardLookup(sh, t->hash, t->name);
+  if (!s)
+    return false;
+  applyTick(sh, s, t->price, t->qty, t->seq);
+  if (!s->inBatch) {
+    if (sh->batchTouchedCount == sh->batchTouchedCap) {
+      int cap = sh->batchTouchedCap ? sh->batchTouchedCap * 2 : 64;
+      Stock **b = (Stock **)realloc(sh->batchTouched, cap * sizeof(Stock *));
+      if (!b) {
+        // Cannot defer: reorder this stock right away
+        updateHeaps(sh, s->id);
+        rankReposition(sh, s);
+        oversoldTrack(sh, s);
+        return true;
+      }
+      sh->batchTouched = b;
+      sh->batchTouchedCap = cap;
+    }
+    s->inBatch = true;
+    sh->batchTouched[sh->batchTouchedCount++] = s;
+  }
+  return true;
+}
+
+// Floyd's bottom-up heap construction over the existing arrays
+void rebuildHeaps(Shard *sh) {
+  if (sh->heapSize < 2)
+    return;
+  for (int i = (sh->heapSize - 2) / HEAP_ARITY; i >= 0; i--) {
+    heapSiftDown(sh->maxHeap, hot.maxHeapIdx, sh->heapSize, i);
+    heapSiftDown(sh->minHeap, hot.minHeapIdx, sh->heapSize, i);
+  }
+}
+
+void batchFinish(Shard *sh) {
+  int logN = 1;
+  while ((1 << logN) < sh->heapSize)
+    logN++;
+  bool rebuild = (long)sh->batchTouchedCount * logN >= sh->heapSize;
+  if (rebuild) {
+    // Refresh the touched keys in place, then restore the order at once
+    for (int i = 0; i < sh->batchTouchedCount; i++) {
+      int id = sh->batchTouched[i]->id;
+      sh->maxHeap[hot.maxHeapIdx[id]].key = hot.gain[id];
+      sh->minHeap[hot.minHeapIdx[id]].key = -hot.gain[id];
+    }
+    rebuildHeaps(sh);
+  }
+
+  for (int i = 0; i < sh->batchTouchedCount; i++) {
+    Stock *s = sh->batchTouched[i];
+    if (!rebuild)
+      updateHeaps(sh, s->id);
+    rankReposition(sh, s);
+    oversoldTrack(sh, s);
+    s->inBatch = false;
+  }
+  sh->batchTouchedCount = 0;
+}
+
+// Apply the shard's queued slice (runs on the shard's worker)
+void shardRunBatch(Shard *sh) {
+  sh->applied = 0;
+  for (int i = 0; i < sh->workCount; i++)
+    if (batchTick(sh, &sh->work[i]))
+      sh->applied++;
+  batchFinish(sh);
+  sh->workCount = 0;
+}
+
+// Queue one tick for the next batchApply. False if it cannot be queued.
+bool batchQueue(const char *name, int64_t price, int qty) {
+  size_t len = strlen(name);
+  if (len == 0 || len >= NAME_LEN)
+    return false;
+  uint32_t h = hashSymbol(name);
+  Shard *sh = shardFor(h);
+  if (sh->workCount == sh->workCap) {
+    int cap = sh->workCap ? sh->workCap * 2 : 256;
+    BatchTick *w = (BatchTick *)realloc(sh->work, cap * sizeof(BatchTick));
+    if (!w)
+      return false;
+    sh->work = w;
+    sh->workCap = cap;
+  }
+  BatchTick *t = &sh->work[sh->workCount++];
+  memcpy(t->name, name, len + 1);
+  t->hash = h;
+  t->seq = transSeq++;
+  t->price = price;
+  t->qty = qty;
+  walLog(WAL_TICK, name, price, qty);
+  return true;
+}
+
+/* ================= WORKER POOL ================= */
+// Fork-join over the shards: workers sleep on poolWake between batches, so
+// everything outside batchApply runs single-threaded on the main thread.
+
+void *shardWorker(void *arg) {
+  Shard *sh = (Shard *)arg;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&poolLock);
+  for (;;) {
+    while (poolGeneration == seen)
+      pthread_cond_wait(&poolWake, &poolLock);
+    seen = poolGeneration;
+    pthread_mutex_unlock(&poolLock);
+
+    shardRunBatch(sh);
+
+    pthread_mutex_lock(&poolLock);
+    if (--poolPending == 0)
+      pthread_cond_signal(&poolDone);
+  }
+  return NULL;
+}
+
+// Set the shard count (before any stock is added) and start the workers.
+// If a thread cannot be created, batches simply run on the main thread.
+// 'logRetain' transactions are kept across all shards; each shard keeps
+// whole segments plus the one being filled.
+void startShards(int n, unsigned long logRetain) {
+  for (int i = 0; i < MAX_SHARDS; i++)
+    shards[i].segments = (SlabPool)SLAB_POOL(LogSegment, LOG_SLAB_SEGMENTS);
+  if (n < 1)
+    n = 1;
+  if (n > MAX_SHARDS)
+    n = MAX_SHARDS;
+  shardCount = n;
+  unsigned long perShard = (logRetain + n - 1) / n;
+  logMaxSegments = (int)((perShard + LOG_SEGMENT_ENTRIES - 1) /
+                         LOG_SEGMENT_ENTRIES) + 1;
+  if (n == 1)
+    return;
+  for (int i = 0; i < n; i++)
+    if (pthread_create(&shards[i].thread, NULL, shardWorker, &shards[i]) != 0)
+      return;
+  poolStarted = true;
+}
+
+// Apply every queued tick; returns how many matched a stock
+int batchApply() {
+  int queued = 0;
+  for (int i = 0; i < shardCount; i++)
+    queued += shards[i].workCount;
+
+  if (poolStarted && queued >= SHARD_INLINE_TICKS) {
+    pthread_mutex_lock(&poolLock);
+    poolPending = shardCount;
+    poolGeneration++;
+    pthread_cond_broadcast(&poolWake);
+    while (poolPending > 0)
+      pthread_cond_wait(&poolDone, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+  } else {
+    for (int i = 0; i < shardCount; i++)
+      shardRunBatch(&shards[i]);
+  }
+
+  int applied = 0;
+  for (int i = 0; i < shardCount; i++)
+    applied += shards[i].applied;
+  walLog(WAL_APPLY, NULL, 0, 0);
+  return applied;
+}
+
+// Parse "SYMBOL PRICE [QTY]". Returns false on a malformed line.
+bool parseTickLine(char *line, char *name, int64_t *price, int *qty) {
+  while (*line == ' ' || *line == '\t')
+    line++;
+  int len = 0;
+  while (*line && *line != ' ' && *line != '\t' && *line != '\n' &&
+         *line != '\r') {
+    if (len == NAME_LEN - 1)
+      return false;
+    name[len++] = *line++;
+  }
+  name[len] = '\0';
+  if (len == 0)
+    return false;
+
+  line = (char *)priceParse(line, price);
+  if (!line)
+    return false;
+  char *end;
+  *qty = (int)strtol(line, &end, 10);
+  if (end == line)
+    *qty = -1; // Quantity is optional
+  return true;
+}
+
+/* ================= SNAPSHOTS (MVCC) ================= */
+// STOCKS, SUMMARY and TOP are answered from an immutable, versioned copy of
+// the portfolio so query threads can render them while the engine keeps
+// applying ticks. A version is published lazily, when a read needs one and
+// something changed: only the stocks dirtied since the last version are
+// path-copied in, O(d log N). Readers pin the version they were handed;
+// the nodes a version replaced are freed once every older version is
+// unpinned (epoch-based reclamation, one epoch per version).
+
+Snapshot *snapCurrent = NULL;  // Newest published version
+Snapshot *snapOldest = NULL;   // Oldest version not yet reclaimed
+unsigned long snapVersion = 1; // Version being built
+SnapNode *snapRoot = NULL;     // Root of the version being built
+SnapNode *snapGarbage = NULL;  // Published nodes it has replaced so far
+SlabPool snapNodePool = SLAB_POOL(SnapNode, SNAP_NODE_SLAB); // Tree nodes
+int snapUnpublished = 0; // Registry prefix loaded from an image, not yet in
+                         // the tree (copied in without dirtying the stocks)
+
+// Queue a stock for the next version (called by the shard's owner)
+void snapMarkDirty(Shard *sh, Stock *s) {
+  if (s->snapDirty)
+    return;
+  if (sh->dirtyCount == sh->dirtyCap) {
+    int cap = sh->dirtyCap ? sh->dirtyCap * 2 : 64;
+    Stock **d = (Stock **)realloc(sh->dirty, cap * sizeof(Stock *));
+    if (!d)
+      return; // Left out of snapshots until it changes again
+    sh->dirty = d;
+    sh->dirtyCap = cap;
+  }
+  s->snapDirty = true;
+  sh->dirty[sh->dirtyCount++] = s;
+}
+
+void stockView(Shard *sh, Stock *s, StockView *v) {
+  const float *ind = stockIndicators(sh, s);
+  v->stock = s->id;
+  v->buyPrice = hot.buy[s->id];
+  v->currentPrice = hot.price[s->id];
+  v->quantity = hot.quantity[s->id];
+  v->percentGain = getPercent(s);
+  v->sma = ind[SLOT_SMA5];
+  v->rsi = ind[SLOT_RSI14];
+  v->upperAlert = s->upperAlert;
+  v->lowerAlert = s->lowerAlert;
+}
+
+int snapHeight(SnapNode *n) { return n ? n->height : 0; }
+
+// Totals are re-summed from the children on every path copy rather than
+// adjusted by deltas. They are integer ticks wrapping modulo 2^64, so read
+// as int64_t they are exact up to ~9.2e14 rupees at PRICE_SCALE 10000.
+void snapFix(SnapNode *n) {
+  n->height = 1 + max_i(snapHeight(n->left), snapHeight(n->right));
+  n->invest = (uint64_t)n->view.buyPrice * (uint64_t)n->view.quantity;
+  n->value = (uint64_t)n->view.currentPrice * (uint64_t)n->view.quantity;
+  if (n->left) {
+    n->invest += n->left->invest;
+    n->value += n->left->value;
+  }
+  if (n->right) {
+    n->invest += n->right->invest;
+    n->value += n->right->value;
+  }
+}
+
+// Writable version of 'n' for the version being built
+SnapNode *snapOwn(SnapNode *n) {
+  if (n->version == snapVersion)
+    return n;
+  SnapNode *c = (SnapNode *)poolAlloc(&snapNodePool);
+  *c = *n;
+  c->version = snapVersion;
+  n->nextGarbage = snapGarbage;
+  snapGarbage = n;
+  return c;
+}
+
+SnapNode *snapRotateRight(SnapNode *y) {
+  SnapNode *x = snapOwn(y->left);
+  y->left = x->right;
+  x->right = y;
+  snapFix(y);
+  snapFix(x);
+  return x;
+}
+
+SnapNode *snapRotateLeft(SnapNode *x) {
+  SnapNode *y = snapOwn(x->right);
+  x->right = y->left;
+  y->left = x;
+  snapFix(x);
+  snapFix(y);
+  return y;
+}
+
+// 'n' must already be owned by the version being built
+SnapNode *snapBalance(SnapNode *n) {
+  snapFix(n);
+  int balance = snapHeight(n->left) - snapHeight(n->right);
+  if (balance > 1) {
+    if (snapHeight(n->left->left) < snapHeight(n->left->right))
+      n->left = snapRotateLeft(snapOwn(n->left));
+    return snapRotateRight(n);
+  }
+  if (balance < -1) {
+    if (snapHeight(n->right->right) < snapHeight(n->right->left))
+      n->right = snapRotateRight(snapOwn(n->right));
+    return snapRotateLeft(n);
+  }
+  return n;
+}
+
+// Insert or replace the view with this name, copying the search path
+SnapNode *snapUpsert(SnapNode *n, const StockView *v) {
+  if (!n) {
+    n = (SnapNode *)poolAlloc(&snapNodePool);
+    memset(n, 0, sizeof(SnapNode));
+    n->view = *v;
+    n->version = snapVersion;
+    snapFix(n);
+    return n;
+  }
+  n = snapOwn(n);
+  int cmp = symbolCompare(v->stock, n->view.stock);
+  if (cmp < 0) {
+    n->left = snapUpsert(n->left, v);
+  } else if (cmp > 0) {
+    n->right = snapUpsert(n->right, v);
+  } else {
+    n->view = *v;
+    snapFix(n);
+    return n;
+  }
+  return snapBalance(n);
+}
+
+void snapFreeList(SnapNode *n) {
+  while (n) {
+    SnapNode *next = n->nextGarbage;
+    poolFree(&snapNodePool, n);
+    n = next;
+  }
+}
+
+// Free versions older than every pinned one, with the nodes only they use
+void snapReclaim() {
+  while (snapOldest != snapCurrent && atomic_load(&snapOldest->pins) == 0) {
+    Snapshot *next = snapOldest->next;
+    snapFreeList(next->garbage);
+    next->garbage = NULL;
+    free(snapOldest);
+    snapOldest = next;
+  }
+}
+
+// Newest version covering every change so far (engine thread only)
+Snapshot *snapPublish() {
+  bool changed = !snapCurrent || snapUnpublished > 0;
+  for (int i = 0; i < snapUnpublished; i++) {
+    StockView v;
+    stockView(stockShard(stockRegistry[i]), stockRegistry[i], &v);
+    snapRoot = snapUpsert(snapRoot, &v);
+  }
+  snapUnpublished = 0;
+  for (int i = 0; i < shardCount; i++) {
+    Shard *sh = &shards[i];
+    for (int j = 0; j < sh->dirtyCount; j++) {
+      StockView v;
+      stockView(sh, sh->dirty[j], &v);
+      snapRoot = snapUpsert(snapRoot, &v);
+      sh->dirty[j]->snapDirty = false;
+    }
+    changed |= sh->dirtyCount > 0;
+    sh->dirtyCount = 0;
+  }
+  if (!changed)
+    return snapCurrent;
+
+  Snapshot *snap = (Snapshot *)calloc(1, sizeof(Snapshot));
+  if (!snap)
+    return snapCurrent; // The changes stay in the version being built
+  snap->version = snapVersion++;
+  snap->root = snapRoot;
+  snap->count = registryCount;
+  snap->hasTop = registryCount > 0;
+  if (snap->hasTop) {
+    Stock *top = topGainer(), *bottom = topLoser();
+    stockView(stockShard(top), top, &snap->topGainer);
+    stockView(stockShard(bottom), bottom, &snap->topLoser);
+  }
+  atomic_init(&snap->pins, 0);
+  snap->garbage = snapGarbage;
+  snapGarbage = NULL;
+
+  if (snapCurrent)
+    snapCurrent->next = snap;
+  else
+    snapOldest = snap;
+  snapCurrent = snap;
+  snapReclaim();
+  return snap;
+}
+
+int snapLiveVersions() {
+  int n = 0;
+  for (Snapshot *v = snapOldest; v; v = v->next)
+    n++;
+  return n;
+}
+
+// Drop every version with its nodes, once the query threads are done with
+// the ones they pinned. Only the engine pins versions, so none can be
+// pinned while it waits here.
+void snapReset() {
+  for (Snapshot *v = snapOldest; v; v = v->next)
+    while (atomic_load(&v->pins) > 0)
+      sched_yield();
+  while (snapOldest) {
+    Snapshot *next = snapOldest->next;
+    free(snapOldest);
+    snapOldest = next;
+  }
+  poolReset(&snapNodePool);
+  snapCurrent = NULL;
+  snapRoot = snapGarbage = NULL;
+  snapUnpublished = 0;
+}
+
+/* ================= RESET ================= */
+// RESET drops every stock and returns the engine to its startup state
+// (registered indicators are kept). Nodes come from slab pools and index
+// structures are flat arrays, so this frees O(#slabs + #shards) blocks
+// whatever the number of stocks.
+
+void shardReset(Shard *sh) {
+  free(sh->table.slots);
+  free(sh->oldTable.slots);
+  free(sh->rankPool);
+  free(sh->maxHeap);
+  free(sh->minHeap);
+  free(sh->oversold.members);
+  free(sh->batchTouched);
+  free(sh->work);
+  free(sh->dirty);
+  poolReset(&sh->segments);
+  pthread_t thread = sh->thread;
+  SlabPool segments = sh->segments;
+  memset(sh, 0, sizeof(*sh));
+  sh->thread = thread;
+  sh->segments = segments;
+}
+
+void engineReset() {
+  snapReset();
+  for (int i = 0; i < shardCount; i++)
+    shardReset(&shards[i]);
+  poolReset(&stockPool);
+  imageRelease(); // Stocks loaded from a checkpoint live in its mapping
+
+  free(stockRegistry);
+  free(hot.price);
+  free(hot.buy);
+  free(hot.quantity);
+  free(hot.gain);
+  free(hot.maxHeapIdx);
+  free(hot.minHeapIdx);
+  stockRegistry = NULL;
+  hot = (StockHot){0};
+  registryCount = stockCapacity = 0;
+  for (int c = 0; c < 32 - SYMBOL_CHUNK_BITS; c++) {
+    free(symbolChunks[c]);
+    symbolChunks[c] = NULL;
+  }
+
+  free(triePool);
+  triePool = NULL;
+  trieCount = trieCap = trieIndexed = 0;
+  free(corrRows);
+  free(corrMeta);
+  free(corrSlotOf);
+  corrRows = NULL;
+  corrMeta = NULL;
+  corrSlotOf = NULL;
+  corrSlots = corrSlotCap = corrSlotOfCap = 0;
+
+  walLog(WAL_RESET, NULL, 0, 0);
+}
+
+/* ================= ANALYSIS ENGINE ================= */
+
+void analyzeIndicators() {
+  printf("\n%-10s | %-8s | %-8s | %-6s | %-15s\n", "STOCK", "PRICE", "SMA(5)",
+         "RSI(14)", "SIGNAL");
+  printf("---------------------------------------------------------------\n");
+
+  for (int i = 0; i < registryCount; i++) {
+    Stock *s = stockRegistry[i];
+    const float *ind = stockIndicators(stockShard(s), s);
+    float sma = ind[SLOT_SMA5];
+    float rsi = ind[SLOT_RSI14];
+
+    char signal[20] = "HOLD";
+
+    // Strategy: RSI Mean Reversion
+    if (rsi < 30)
+      strcpy(signal, "BUY (Oversold)");
+    else if (rsi > 70)
+      strcpy(signal, "SELL (Overbought)");
+
+    printf("%-10s | %8.2f | %8.2f | %6.1f | %s\n", symbolName(s->id),
+           priceValue(hot.price[i]), sma, rsi, signal);
+  }
+
+  printf("\n[Graph Analysis] Sector Risk Clusters (Correlated Oversold "
+         "Stocks):\n");
+  int n;
+  Stock **members = oversoldMembers(&n);
+  if (n >= 2) {
+    printf("  Cluster: %s", symbolName(members[0]->id));
+    for (int i = 1; i < n; i++)
+      printf(", %s", symbolName(members[i]->id));
+    printf("\n");
+  } else {
+    printf("  None detected.\n");
+  }
+  free(members);
+}
+
+/* ================= TEST HARNESS ================= */
+
+void runAutoTest() {
+  printf("\n=== RUNNING AUTOMATED TEST HARNESS ===\n");
+
+  // 1. Insert Stocks
+  addStock("RELIANCE", 2400 * PRICE_SCALE, 10);
+  addStock("TCS", 3500 * PRICE_SCALE, 5);
+  addStock("INFY", 1500 * PRICE_SCALE, 20);
+
+  // 2. Simulate Price History for RELIANCE (Downtrend -> Oversold)
+  int64_t rel_prices[] = {2380, 2350, 2300, 2250, 2200, 2150,
+                          2100, 2050, 2000, 1950, 1900, 1850};
+  for (int i = 0; i < 12; i++)
+    updateStockPrice("RELIANCE", rel_prices[i] * PRICE_SCALE, 10, true);
+
+  // 3. Simulate Price History for TCS (Uptrend)
+  int64_t tcs_prices[] = {3550, 3600, 3650, 3700, 3750, 3800, 3850, 3900};
+  for (int i = 0; i < 8; i++)
+    updateStockPrice("TCS", tcs_prices[i] * PRICE_SCALE, 5, true);
+
+  // 4. Simulate Price History for INFY (Correlation with RELIANCE - also
+  // crashing)
+  int64_t infy_prices[] = {1480, 1450, 1400, 1350, 1300,
+                           1250, 1200, 1150, 1100};
+  for (int i = 0; i < 9; i++)
+    updateStockPrice("INFY", infy_prices[i] * PRICE_SCALE, 20, true);
+
+  // 5. Verify Structures
+  Stock *gainer = topGainer();
+  Stock *loser = topLoser();
+  printf("\n[Validation] Top Gainer: %s (%.2f%%)\n", symbolName(gainer->id),
+         getPercent(gainer));
+  printf("[Validation] Top Loser:  %s (%.2f%%)\n", symbolName(loser->id),
+         getPercent(loser));
+
+  printf("\n[Validation] Trie Search 'TCS': %s\n",
+         searchTrie("TCS") ? "FOUND" : "FAIL");
+  printf("[Validation] Trie Search 'XYZ': %s\n",
+         searchTrie("XYZ") ? "FOUND" : "NOT FOUND (Correct)");
+
+  // 6. Run Analysis
+  analyzeIndicators();
+  printf("\n=== TEST COMPLETE ===\n");
+}
+
+/* ================= SELF-TEST ================= */
+// ./dsa2 --selftest checks what must hold for any shard count, on a fresh
+// engine per count, and exits non-zero if anything fails.
+
+#define SELFTEST_TIE_STOCKS (3 * SHARD_INLINE_TICKS)
+
+void selfTestCollect(Stock *s, void *ctx) {
+  Stock ***next = ctx;
+  *(*next)++ = s;
+}
+
+// Equal gains go to the stock added first in the heaps (TOP) and in the
+// gain tree (TOPK, BOTTOMK, RANK) alike. Every third stock gains 10% and
+// every third after it loses 10%. The ticks come in reverse id order, half
+// one at a time and half as a batch big enough for the shard workers.
+bool selfTestTieOrder() {
+  static Stock *order[SELFTEST_TIE_STOCKS];
+  char name[NAME_LEN];
+  for (int i = 0; i < SELFTEST_TIE_STOCKS; i++) {
+    snprintf(name, sizeof(name), "TIE%04d", i);
+    if (addStock(name, 100 * (int64_t)PRICE_SCALE, 1) != ST_OK)
+      return false;
+  }
+  for (int i = SELFTEST_TIE_STOCKS - 1; i >= 0; i--) {
+    int64_t price = (100 + (i % 3 == 1) * 10 - (i % 3 == 2) * 10) *
+                    (int64_t)PRICE_SCALE;
+    snprintf(name, sizeof(name), "TIE%04d", i);
+    if (i >= SELFTEST_TIE_STOCKS / 2)
+      updateStockPrice(name, price, -1, true);
+    else
+      batchQueue(name, price, -1);
+  }
+  batchApply();
+
+  for (int pass = 0; pass < 2; pass++) {
+    bool descending = pass == 0;
+    Stock **next = order;
+    rankWalk(descending, SELFTEST_TIE_STOCKS, selfTestCollect, &next);
+    if (next - order != SELFTEST_TIE_STOCKS)
+      return false;
+    if (order[0] != (descending ? topGainer() : topLoser()))
+      return false;
+    for (int k = 0; k < SELFTEST_TIE_STOCKS; k++) {
+      if (k > 0) {
+        float a = getPercent(order[k - 1]), b = getPercent(order[k]);
+        if ((descending ? a < b : a > b) ||
+            (a == b && order[k - 1]->id > order[k]->id))
+          return false;
+      }
+      // The tree read backwards is the ranking: RANK k+1 is order[k]
+      int idx = SELFTEST_TIE_STOCKS - 1 - k;
+      if (descending &&
+          (rankIndexOf(order[k]) != idx || rankSelect(idx) != order[k]))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Each shard count gets its own engine in a child process, so no state
+// carries over and startShards sees a fresh start every time
+int runSelfTest(int nShards, unsigned long logRetain) {
+  printf("Tie order (TOP, TOPK, BOTTOMK, RANK), shards");
+#ifdef _WIN32
+  // No fork: one engine, with the --shards count
+  startShards(nShards, logRetain);
+  bool ok = selfTestTieOrder();
+  printf(" %d%s", shardCount, ok ? "" : " (FAILED)");
+#else
+  (void)nShards;
+  static const int counts[] = {1, 2, 3, 5, 8};
+  bool ok = true;
+  for (int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      startShards(counts[c], logRetain);
+      _exit(selfTestTieOrder() ? 0 : 1);
+    }
+    int status = 0;
+    bool passed = pid > 0 && waitpid(pid, &status, 0) == pid &&
+                  WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf(" %d%s", counts[c], passed ? "" : " (FAILED)");
+    ok = ok && passed;
+  }
+#endif
+  printf(": %s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+/* ================= BENCHMARK ================= */
+// Grows the universe in decades (10, 100, ... maxSymbols) and reports the
+// average cost of the ADDs in each decade and of random UPDATEs at that size,
+// both one at a time and through the UPDATEBATCH path.
+
+#define BENCH_UPDATES 200000
+#define BENCH_BATCH 4096
+#define BENCH_LATENCY_SAMPLES 200000
+#define BENCH_SEARCHES 100000
+#define BENCH_CORR_SYMBOLS 5000
+#define BENCH_SCAN_STOCKS 10000000 // Stocks visited per timed scan/heap pass
+#define BENCH_REHEAPS 100000 // Heap re-keys timed by benchReheap
+#define BENCH_RESPONSES 20 // STOCKS responses rendered by benchStocksJSON
+
+double nowNs() {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Unique A-Z symbol for index i
+void benchSymbol(int i, char *out) {
+  out[0] = 'B';
+  for (int k = 6; k >= 1; k--) {
+    out[k] = 'A' + i % 26;
+    i /= 26;
+  }
+  out[7] = '\0';
+}
+
+void benchCount(Stock *s, void *ctx) {
+  (void)s;
+  (*(int *)ctx)++;
+}
+
+uint32_t benchRand(uint32_t *state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+volatile double benchSink; // Keeps the timed scans from being optimized out
+
+// A random tick for stock 'id': 80%..120% of its buy price
+int64_t benchPrice(uint32_t *rng, int id) {
+  return hot.buy[id] * (8000 + benchRand(rng) % 4000) / 10000;
+}
+
+// Per-tick heap cost: move random stocks to a new price in both heaps of
+// their shard, timed, then put the old prices back
+double benchReheap(uint32_t *rng) {
+  int *ids = (int *)malloc(BENCH_REHEAPS * sizeof(int));
+  int64_t *old = (int64_t *)malloc(BENCH_REHEAPS * sizeof(int64_t));
+  Shard **owner = (Shard **)malloc(BENCH_REHEAPS * sizeof(Shard *));
+  double ns = 0;
+  if (ids && old && owner) {
+    for (int u = 0; u < BENCH_REHEAPS; u++) {
+      ids[u] = benchRand(rng) % registryCount;
+      owner[u] = stockShard(stockRegistry[ids[u]]);
+      old[u] = hot.price[ids[u]];
+    }
+    double t0 = nowNs();
+    for (int u = 0; u < BENCH_REHEAPS; u++) {
+      setPrice(ids[u], benchPrice(rng, ids[u]));
+      updateHeaps(owner[u], ids[u]);
+    }
+    ns = (nowNs() - t0) / BENCH_REHEAPS;
+    for (int u = BENCH_REHEAPS - 1; u >= 0; u--) {
+      setPrice(ids[u], old[u]);
+      updateHeaps(owner[u], ids[u]);
+    }
+  }
+  free(ids);
+  free(old);
+  free(owner);
+  return ns;
+}
+
+// Fill a full window for the first BENCH_CORR_SYMBOLS stocks, then time
+// building their return rows and correlating every pair
+void benchCorrelation(uint32_t *rng) {
+  int n = registryCount < BENCH_CORR_SYMBOLS ? registryCount
+                                             : BENCH_CORR_SYMBOLS;
+  for (int t = 0; t < HISTORY_SIZE; t++)
+    for (int i = 0; i < n; i++) {
+      Stock *s = stockRegistry[i];
+      int64_t step = (int)(benchRand(rng) % 2001) - 1000; // +/-1% in 1e-5
+      int64_t price = hot.price[i] * (100000 + step) / 100000;
+      updateStockPrice(symbolName(s->id), price, -1, true);
+    }
+  double t0 = nowNs();
+  corrSync();
+  double rowsMs = (nowNs() - t0) / 1e6;
+  CorrEdge edges[100];
+  int kept;
+  t0 = nowNs();
+  long matched = corrPairs(0.5f, edges, &kept, 100);
+  double pairsMs = (nowNs() - t0) / 1e6;
+  double pairs = (double)corrSlots * (corrSlots - 1) / 2;
+  printf("\nCorrelation, %d-tick window: %d rows built in %.1f ms, %.0f pairs "
+         "in %.1f ms (%.1f ns/pair, %ld with |r| >= 0.5)\n",
+         HISTORY_SIZE, corrSlots, rowsMs, pairs, pairsMs,
+         pairs > 0 ? pairsMs * 1e6 / pairs : 0, matched);
+}
+
+// Drop the whole benchmark state, as RESET does
+void benchReset() {
+  int stocks = registryCount;
+  int slabs = stockPool.slabCount + snapNodePool.slabCount;
+  for (int i = 0; i < shardCount; i++)
+    slabs += shards[i].segments.slabCount;
+  long rss = residentBytes();
+  double t0 = nowNs();
+  engineReset();
+  double ms = (nowNs() - t0) / 1e6;
+  printf("\nRESET of %d symbols: %d slabs freed in %.2f ms, RSS %.1f -> "
+         "%.1f MB\n",
+         stocks, slabs, ms, rss / 1048576.0, residentBytes() / 1048576.0);
+}
+
+void runBenchmark(int maxSymbols) {
+  if (maxSymbols < 10)
+    maxSymbols = 10;
+  char name[NAME_LEN];
+  uint32_t rng = 12345;
+
+  printf("Shards: %d\n", shardCount);
+  printf("%-8s | %-9s | %-9s | %-9s | %-9s | %-9s | %-9s | %-9s\n",
+         "SYMBOLS", "ns/ADD", "ns/UPDATE", "ns/BATCHED", "ns/SEARCH",
+         "ns/SCAN", "ns/HEAPIFY", "ns/REHEAP");
+  printf("--------------------------------------------------------------------"
+         "----------------------------\n");
+
+  for (int level = 10;; level *= 10) {
+    if (level > maxSymbols)
+      level = maxSymbols;
+    int from = registryCount;
+    double t0 = nowNs();
+    for (int i = from; i < level; i++) {
+      benchSymbol(i, name);
+      addStock(name, (100 + i % 900) * (int64_t)PRICE_SCALE, 1 + i % 50);
+    }
+    double addNs = level > from ? (nowNs() - t0) / (level - from) : 0;
+
+    t0 = nowNs();
+    for (int u = 0; u < BENCH_UPDATES; u++) {
+      int id = benchRand(&rng) % registryCount;
+      updateStockPrice(symbolName(id), benchPrice(&rng, id), -1, true);
+    }
+    double updNs = (nowNs() - t0) / BENCH_UPDATES;
+
+    t0 = nowNs();
+    for (int u = 0; u < BENCH_UPDATES; u++) {
+      int id = benchRand(&rng) % registryCount;
+      batchQueue(symbolName(id), benchPrice(&rng, id), -1);
+      if ((u + 1) % BENCH_BATCH == 0)
+        batchApply();
+    }
+    batchApply();
+    double batchNs = (nowNs() - t0) / BENCH_UPDATES;
+
+    // Autocomplete: first 10 symbols sharing a random symbol's 5-byte prefix
+    trieSync();
+    int found = 0;
+    t0 = nowNs();
+    for (int u = 0; u < BENCH_SEARCHES; u++) {
+      char prefix[6];
+      memcpy(prefix, symbolName(benchRand(&rng) % registryCount), 5);
+      prefix[5] = '\0';
+      int left = 10, node = trieFind(prefix);
+      if (node >= 0)
+        trieWalk(node, &left, benchCount, &found);
+    }
+    double searchNs = (nowNs() - t0) / BENCH_SEARCHES;
+
+    // Per stock: a market value scan, and a heap pass comparing every gain
+    int passes = 1 + BENCH_SCAN_STOCKS / registryCount;
+    uint64_t value = 0;
+    t0 = nowNs();
+    for (int r = 0; r < passes; r++)
+      for (int i = 0; i < registryCount; i++)
+        value += (uint64_t)hot.price[i] * (uint64_t)hot.quantity[i];
+    double scanNs = (nowNs() - t0) / ((double)passes * registryCount);
+    benchSink = (double)value;
+    t0 = nowNs();
+    for (int r = 0; r < passes; r++)
+      for (int i = 0; i < shardCount; i++)
+        rebuildHeaps(&shards[i]);
+    double heapNs = (nowNs() - t0) / ((double)passes * registryCount);
+    double reheapNs = benchReheap(&rng);
+
+    printf("%-8d | %9.1f | %9.1f | %10.1f | %9.1f | %9.2f | %10.2f | %9.1f\n",
+           level, addNs, updNs, batchNs, searchNs, scanNs, heapNs, reheapNs);
+    fflush(stdout);
+    if (level == maxSymbols)
+      break;
+  }
+  benchStocksJSON();
+  benchCorrelation(&rng);
+  benchCheckpoint(&rng);
+  benchReset();
+}
+
+int compareDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void benchLatencyLine(const char *label, double *ns, int n) {
+  if (n == 0)
+    return;
+  qsort(ns, n, sizeof(double), compareDouble);
+  printf("%-12s | %8d | %8.0f | %8.0f | %8.0f | %10.0f\n", label, n,
+         ns[n / 2], ns[(int)(n * 0.99)], ns[(int)(n * 0.999)], ns[n - 1]);
+}
+
+// Time single UPDATEs until n samples are taken, or until a running
+// background checkpoint finishes if 'untilDone'
+int benchTimedUpdates(uint32_t *rng, double *ns, int n, bool untilDone) {
+  int i = 0;
+  for (; i < n && (!untilDone || checkpointPoll(false)); i++) {
+    int id = benchRand(rng) % registryCount;
+    int64_t price = benchPrice(rng, id);
+    double t0 = nowNs();
+    updateStockPrice(symbolName(id), price, -1, true);
+    ns[i] = nowNs() - t0;
+  }
+  return i;
+}
+
+/* ================= SPSC RING ================= */
+// Lock-free on the fast path: one acquire load and one release store per
+// operation. Only a side that has polled RING_SPIN times without progress
+// sleeps on the condition variable, so an idle engine costs no CPU.
+
+SpscRing ingestRing;   // Reader -> engine: CmdRecord
+SpscRing responseRing; // Engine -> writer: Response
+SpscRing freeRing;     // Writer -> engine: drained OutBuf for reuse
+
+bool ringInit(SpscRing *r, size_t slots, size_t elemSize) {
+  r->slots = (unsigned char *)malloc(slots * elemSize);
+  if (!r->slots)
+    return false;
+  r->mask = slots - 1;
+  r->elemSize = elemSize;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->headCache = r->tailCache = 0;
+  atomic_init(&r->fullStalls, 0);
+  atomic_init(&r->emptyStalls, 0);
+  atomic_init(&r->highWater, 0);
+  atomic_init(&r->parked, 0);
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->wake, NULL);
+  return true;
+}
+
+size_t ringDepth(SpscRing *r) {
+  return atomic_load(&r->tail) - atomic_load(&r->head);
+}
+
+bool ringBlocked(SpscRing *r, bool forPush) {
+  size_t depth = ringDepth(r);
+  return forPush ? depth > r->mask : depth == 0;
+}
+
+// Wake the other side if it went to sleep. The fence pairs with the one in
+// ringWait: either the sleeper sees our update or we see its flag.
+void ringNotify(SpscRing *r) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&r->parked, memory_order_relaxed)) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+void ringWait(SpscRing *r, bool forPush) {
+  for (int i = 0; i < RING_SPIN; i++)
+    if (!ringBlocked(r, forPush))
+      return;
+  pthread_mutex_lock(&r->lock);
+  // A count, not a flag: a side that is just waking must not hide the
+  // other one that has meanwhile gone to sleep
+  atomic_fetch_add(&r->parked, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (ringBlocked(r, forPush))
+    pthread_cond_wait(&r->wake, &r->lock);
+  atomic_fetch_sub(&r->parked, 1);
+  pthread_mutex_unlock(&r->lock);
+}
+
+bool ringTryPush(SpscRing *r, const void *elem) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if (tail - r->headCache > r->mask) {
+    r->headCache = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - r->headCache > r->mask)
+      return false;
+  }
+  memcpy(r->slots + (tail & r->mask) * r->elemSize, elem, r->elemSize);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  size_t depth = tail + 1 - r->headCache;
+  if (depth > atomic_load_explicit(&r->highWater, memory_order_relaxed))
+    atomic_store_explicit(&r->highWater, depth, memory_order_relaxed);
+  ringNotify(r);
+  return true;
+}
+
+bool ringTryPop(SpscRing *r, void *elem) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head == r->tailCache) {
+    r->tailCache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == r->tailCache)
+      return false;
+  }
+  memcpy(elem, r->slots + (head & r->mask) * r->elemSize, r->elemSize);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  ringNotify(r);
+  return true;
+}
+
+// Blocking variants; every wait is counted as a stall
+void ringPush(SpscRing *r, const void *elem) {
+  while (!ringTryPush(r, elem)) {
+    atomic_fetch_add_explicit(&r->fullStalls, 1, memory_order_relaxed);
+    ringWait(r, true);
+  }
+}
+
+void ringPop(SpscRing *r, void *elem) {
+  while (!ringTryPop(r, elem)) {
+    atomic_fetch_add_explicit(&r->emptyStalls, 1, memory_order_relaxed);
+    ringWait(r, false);
+  }
+}
+
+/* ================= API MODE ================= */
+// Responses are assembled in one buffer and handed to the writer thread,
+// so the same command code serves the text and binary protocols.
+
+typedef struct OutBuf {
+  char *data;
+  size_t len, cap;
+} OutBuf;
+
+// A deferred response is a placeholder for a snapshot read handed to query
+// thread 'worker'; the writer takes the rendered buffer from that thread,
+// so responses still leave in command order.
+typedef struct Response {
+  OutBuf buf;
+  bool deferred;
+  int worker;
+  unsigned long walLsn; // Log bytes that must be durable before it is sent
+} Response;
+
+_Thread_local OutBuf out = {0}; // Response under construction (per thread)
+bool binaryMode = false;
+
+bool bufReserve(OutBuf *b, size_t extra) {
+  if (b->len + extra <= b->cap)
+    return true;
+  size_t cap = b->cap ? b->cap : 4096;
+  while (cap < b->len + extra)
+    cap *= 2;
+  char *data = (char *)realloc(b->data, cap);
+  if (!data)
+    return false;
+  b->data = data;
+  b->cap = cap;
+  return true;
+}
+
+bool outReserve(size_t extra) { return bufReserve(&out, extra); }
+
+void outBytes(const void *p, size_t n) {
+  if (!outReserve(n))
+    return;
+  memcpy(out.data + out.len, p, n);
+  out.len += n;
+}
+
+void outf(const char *fmt, ...) {
+  if (!out.data && !outReserve(256))
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(out.data + out.len, out.cap - out.len, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if ((size_t)n >= out.cap - out.len) {
+    if (!outReserve((size_t)n + 1))
+      return;
+    va_start(ap, fmt);
+    vsnprintf(out.data + out.len, out.cap - out.len, fmt, ap);
+    va_end(ap);
+  }
+  out.len += n;
+}
+
+// Append-only formatters for the per-stock lists, which would otherwise
+// spend most of their time parsing outf's format string
+
+void outStr(const char *s) { outBytes(s, strlen(s)); }
+
+void outInt(long v) {
+  char buf[24], *p = buf + sizeof(buf);
+  unsigned long u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+  do
+    *--p = (char)('0' + u % 10);
+  while (u /= 10);
+  if (v < 0)
+    *--p = '-';
+  outBytes(p, buf + sizeof(buf) - p);
+}
+
+// Same bytes as "%.2f". Values too close to a rounding tie for v * 100 to
+// decide (and NaN, infinities, huge values) are left to snprintf.
+void outFixed2(double v) {
+  double x = fabs(v) * 100;
+  double r = nearbyint(x);
+  if (!(x < 1e15) || 0.5 - fabs(x - r) <= x * 0x1p-52) {
+    char buf[352];
+    int n = snprintf(buf, sizeof(buf), "%.2f", v);
+    if (n > 0)
+      outBytes(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+    return;
+  }
+  char buf[24], *p = buf + sizeof(buf);
+  uint64_t c = (uint64_t)r;
+  *--p = (char)('0' + c % 10);
+  *--p = (char)('0' + c / 10 % 10);
+  *--p = '.';
+  c /= 100;
+  do
+    *--p = (char)('0' + c % 10);
+  while (c /= 10);
+  if (signbit(v))
+    *--p = '-';
+  outBytes(p, buf + sizeof(buf) - p);
+}
+
+// Ticks as rupees to two decimals, rounded half away from zero. All integer,
+// so a price prints exactly as it was entered (up to the paisa).
+void outPrice(int64_t ticks) {
+  const uint64_t perPaisa = PRICE_SCALE / 100;
+  char buf[24], *p = buf + sizeof(buf);
+  uint64_t c = ticks < 0 ? 0 - (uint64_t)ticks : (uint64_t)ticks;
+  c = c / perPaisa + (c % perPaisa * 2 >= perPaisa);
+  bool negative = ticks < 0 && c > 0;
+  *--p = (char)('0' + c % 10);
+  *--p = (char)('0' + c / 10 % 10);
+  *--p = '.';
+  c /= 100;
+  do
+    *--p = (char)('0' + c % 10);
+  while (c /= 10);
+  if (negative)
+    *--p = '-';
+  outBytes(p, buf + sizeof(buf) - p);
+}
+
+// Hand the finished response (and the log records of its command) to the
+// writer thread and continue in a recycled buffer (or a fresh one if none
+// has come back yet)
+void outFlush() {
+  unsigned long lsn = walSubmit();
+  if (!out.data)
+    return; // Nothing could be allocated for this response
+  Response r = {out, false, 0, lsn};
+  ringPush(&responseRing, &r);
+  if (!ringTryPop(&freeRing, &out))
+    out = (OutBuf){0};
+  out.len = 0;
+}
+
+// Helper to sanitize float printing to JSON
+void printFloat(float f) {
+  if (isnan(f))
+    outStr("null");
+  else
+    outFixed2(f);
+}
+
+// Queue the ticks the reader parsed behind an UPDATEBATCH header
+int queueBatchRecords(int *rejected) {
+  CmdRecord rec;
+  int queued = 0;
+  do {
+    ringPop(&ingestRing, &rec);
+    for (int i = 0; i < rec.count; i++) {
+      RecordTick *t = &rec.ticks[i];
+      if (batchQueue(t->name, t->price, t->qty))
+        queued++;
+      else
+        (*rejected)++;
+    }
+  } while (!rec.last);
+  return queued;
+}
+
+// UPDATEBATCH n: the next n lines are "SYMBOL PRICE [QTY]" ticks
+void cmdUpdateBatch() {
+  int rejected = 0;
+  int queued = queueBatchRecords(&rejected);
+  int applied = batchApply();
+  rejected += queued - applied;
+
+  outf("{\"status\": \"ok\", \"message\": \"Batch Applied\", \"applied\": %d, "
+       "\"rejected\": %d}\n",
+       applied, rejected);
+}
+
+void printViewJSON(const StockView *v) {
+  outStr("{\"name\": \"");
+  outStr(symbolName(v->stock));
+  outStr("\", \"buyPrice\": ");
+  outPrice(v->buyPrice);
+  outStr(", \"currentPrice\": ");
+  outPrice(v->currentPrice);
+  outStr(", \"quantity\": ");
+  outInt(v->quantity);
+  outStr(", \"percentGain\": ");
+  outFixed2(v->percentGain);
+  outStr(", \"sma\": ");
+  outFixed2(v->sma);
+  outStr(", \"rsi\": ");
+  outFixed2(v->rsi);
+  outStr(", \"upperAlert\": ");
+  outPrice(v->upperAlert);
+  outStr(", \"lowerAlert\": ");
+  outPrice(v->lowerAlert);
+  outStr("}");
+}
+
+// Print single stock object as JSON
+void printStockJSON(Stock *s) {
+  StockView v;
+  stockView(stockShard(s), s, &v);
+  printViewJSON(&v);
+}
+
+// Comma-separated element of a JSON array ('ctx' tracks the first one)
+void printListJSON(Stock *s, void *ctx) {
+  bool *isFirst = (bool *)ctx;
+  if (!*isFirst)
+    outStr(",");
+  printStockJSON(s);
+  *isFirst = false;
+}
+
+void printSnapJSON(SnapNode *n, bool *isFirst) {
+  if (n) {
+    printSnapJSON(n->left, isFirst);
+    if (!*isFirst)
+      outStr(",");
+    printViewJSON(&n->view);
+    *isFirst = false;
+    printSnapJSON(n->right, isFirst);
+  }
+}
+
+// The three snapshot reads below may run on a query thread, so they only
+// look at the (immutable) snapshot they are given.
+typedef enum { QUERY_NONE, QUERY_STOCKS, QUERY_SUMMARY, QUERY_TOP } QueryKind;
+
+// All stocks sorted by name
+void cmdStocks(Snapshot *snap) {
+  outf("[");
+  bool isFirst = true;
+  printSnapJSON(snap->root, &isFirst);
+  outf("]\n");
+}
+
+// Render the full STOCKS response repeatedly into the output buffer
+void benchStocksJSON() {
+  Snapshot *snap = snapPublish();
+  if (!snap)
+    return;
+  double t0 = nowNs();
+  size_t bytes = 0;
+  for (int i = 0; i < BENCH_RESPONSES; i++) {
+    out.len = 0;
+    cmdStocks(snap);
+    bytes = out.len;
+  }
+  double ns = (nowNs() - t0) / BENCH_RESPONSES;
+  out.len = 0;
+  printf("\nSTOCKS response of %d symbols: %zu KB in %.2f ms (%.0f "
+         "ns/stock)\n",
+         snap->count, bytes / 1024, ns / 1e6, ns / max_i(snap->count, 1));
+}
+
+void cmdTop(Snapshot *snap) {
+  outf("{");
+  if (snap->hasTop) {
+    outf("\"topGainer\": ");
+    printViewJSON(&snap->topGainer);
+    outf(", \"topLoser\": ");
+    printViewJSON(&snap->topLoser);
+  } else {
+    outf("\"topGainer\": null, \"topLoser\": null");
+  }
+  outf("}\n");
+}
+
+// O(1): the tree keeps investment/value totals per subtree
+void cmdSummary(Snapshot *snap) {
+  uint64_t invest = snap->root ? snap->root->invest : 0;
+  uint64_t value = snap->root ? snap->root->value : 0;
+
+  outStr("{\"totalInvestment\": ");
+  outPrice((int64_t)invest);
+  outStr(", \"currentValue\": ");
+  outPrice((int64_t)value);
+  outStr(", \"profit\": ");
+  outPrice((int64_t)(value - invest));
+  outf(", \"stockCount\": %d}\n", snap->count);
+}
+
+// SORTED / TOPK / BOTTOMK: stocks by gain
+void cmdRanked(bool descending, int k) {
+  outf("[");
+  bool isFirst = true;
+  rankWalk(descending, k, printListJSON, &isFirst);
+  outf("]\n");
+}
+
+// Autocomplete entry: symbol and current price only
+void printSearchJSON(Stock *s, void *ctx) {
+  bool *isFirst = (bool *)ctx;
+  outStr(*isFirst ? "{\"name\": \"" : ",{\"name\": \"");
+  outStr(symbolName(s->id));
+  outStr("\", \"currentPrice\": ");
+  outPrice(hot.price[s->id]);
+  outStr("}");
+  *isFirst = false;
+}
+
+// SEARCH prefix [limit]: the first 'limit' symbols starting with 'prefix',
+// in byte order
+void cmdSearch(const char *prefix, int limit) {
+  outf("[");
+  bool isFirst = true;
+  int node = limit > 0 ? trieFind(prefix) : -1;
+  if (node >= 0)
+    trieWalk(node, &limit, printSearchJSON, &isFirst);
+  outf("]\n");
+}
+
+void cmdRank(char *name) {
+  Stock *s = findStock(name);
+  if (!s) {
+    outf("{\"error\": \"Stock not found\"}\n");
+    return;
+  }
+  // Rank 1 is the top gainer
+  int rank = registryCount - rankIndexOf(s);
+  outf("{\"name\": \"%s\", \"rank\": %d, \"count\": %d, "
+       "\"percentGain\": %.2f}\n",
+       symbolName(s->id), rank, registryCount, getPercent(s));
+}
+
+// Nearest-rank percentile over the gain distribution (0 = worst, 100 = best)
+void cmdPercentile(float p) {
+  if (!isfinite(p)) { // NaN would pass both clamps
+    outf("{\"error\": \"Invalid percentile\"}\n");
+    return;
+  }
+  if (registryCount == 0) {
+    outf("{\"error\": \"No stocks\"}\n");
+    return;
+  }
+  if (p < 0)
+    p = 0;
+  if (p > 100)
+    p = 100;
+  int k = (int)ceilf(p / 100.0f * registryCount);
+  if (k < 1)
+    k = 1;
+  Stock *s = rankSelect(k - 1);
+  outf("{\"percentile\": %.2f, \"rank\": %d, \"stock\": ", p,
+       registryCount - k + 1);
+  printStockJSON(s);
+  outf("}\n");
+}
+
+void cmdTrends(char *name) {
+  uint32_t h = hashSymbol(name);
+  Shard *sh = shardFor(h);
+  Stock *s = shardLookup(sh, h, name);
+  if (!s) {
+    outf("{\"error\": \"Stock not found\"}\n");
+    return;
+  }
+
+  const float *ind = stockIndicators(sh, s);
+  float sma = ind[SLOT_SMA5];
+  float rsi = ind[SLOT_RSI14];
+  char signal[50] = "HOLD";
+  char confidence[10] = "MEDIUM";
+
+  if (rsi < 30) {
+    strcpy(signal, "BUY (Oversold)");
+    strcpy(confidence, "HIGH");
+  } else if (rsi > 70) {
+    strcpy(signal, "SELL (Overbought)");
+    strcpy(confidence, "HIGH");
+  }
+
+  outf("{\"name\": \"%s\", \"sma\": %.2f, \"rsi\": %.2f, \"recommendation\": "
+       "\"%s\", \"confidence\": \"%s\", \"indicators\": {",
+       symbolName(s->id), sma, rsi, signal, confidence);
+  for (int i = 0; i < indicatorCount; i++) {
+    char label[16];
+    indicatorLabel(&indicatorSpecs[i], label);
+    outf("%s\"%s\": %.2f", i ? ", " : "", label, ind[i]);
+  }
+  outf("}}\n");
+}
+
+// Slot of a stock's correlation row, or -1 after reporting why not
+int corrSlotFor(char *name) {
+  Stock *s = findStock(name);
+  if (!s) {
+    outf("{\"error\": \"Stock not found\"}\n");
+    return -1;
+  }
+  int slot = corrSlot(s->id);
+  if (slot < 0)
+    outf("{\"error\": \"%s needs %d ticks of history\"}\n", symbolName(s->id),
+         HISTORY_SIZE);
+  return slot;
+}
+
+// CORR a b: Pearson correlation of the two stocks' recent returns
+void cmdCorr(char *a, char *b) {
+  int sa = corrSlotFor(a);
+  if (sa < 0)
+    return;
+  int sb = corrSlotFor(b);
+  if (sb < 0)
+    return;
+  float r = corrMeta[sa].valid && corrMeta[sb].valid
+                ? corrDot(corrRow(sa), corrRow(sb))
+                : 0;
+  outf("{\"a\": \"%s\", \"b\": \"%s\", \"corr\": %.4f, \"window\": %d}\n",
+       symbolName(corrMeta[sa].stock),
+       symbolName(corrMeta[sb].stock), corrClamp(r), CORR_WINDOW);
+}
+
+// CORR_TOP name k: the k stocks moving most closely with 'name'
+void cmdCorrTop(char *name, int k) {
+  int slot = corrSlotFor(name);
+  if (slot < 0)
+    return;
+  if (k > CORR_EDGES_MAX)
+    k = CORR_EDGES_MAX;
+  CorrEdge *top = (CorrEdge *)malloc((k > 0 ? k : 1) * sizeof(CorrEdge));
+  if (!top) {
+    outf("{\"error\": \"%s\"}\n", statusMessage(ST_NO_MEMORY));
+    return;
+  }
+  int n = k > 0 && corrMeta[slot].valid ? corrTop(slot, top, k) : 0;
+  outf("[");
+  for (int i = 0; i < n; i++)
+    outf("%s{\"name\": \"%s\", \"corr\": %.4f}", i ? "," : "",
+         symbolName(corrMeta[top[i].b].stock), corrClamp(top[i].corr));
+  outf("]\n");
+  free(top);
+}
+
+// CORR_EDGES threshold limit: pairs with |corr| >= threshold, strongest
+// first, as the edge list of the correlation graph
+void cmdCorrEdges(float threshold, int limit) {
+  if (limit > CORR_EDGES_MAX)
+    limit = CORR_EDGES_MAX;
+  if (limit < 0)
+    limit = 0;
+  CorrEdge *edges =
+      (CorrEdge *)malloc((limit > 0 ? limit : 1) * sizeof(CorrEdge));
+  if (!edges) {
+    outf("{\"error\": \"%s\"}\n", statusMessage(ST_NO_MEMORY));
+    return;
+  }
+  int kept;
+  long matched = corrPairs(threshold, edges, &kept, limit);
+  outf("{\"window\": %d, \"threshold\": %.2f, \"stocks\": %d, "
+       "\"matched\": %ld, \"edges\": [",
+       CORR_WINDOW, threshold, corrSlots, matched);
+  for (int i = 0; i < kept; i++)
+    outf("%s{\"a\": \"%s\", \"b\": \"%s\", \"corr\": %.4f}", i ? "," : "",
+         symbolName(corrMeta[edges[i].a].stock),
+         symbolName(corrMeta[edges[i].b].stock),
+         corrClamp(edges[i].corr));
+  outf("]}\n");
+  free(edges);
+}
+
+// INDICATOR SMA|RSI period: add a period computed on every tick
+void cmdIndicator(char *type, int period) {
+  int slot = -1;
+  if (strcmp(type, "SMA") == 0)
+    slot = registerIndicator(IND_SMA, period);
+  else if (strcmp(type, "RSI") == 0)
+    slot = registerIndicator(IND_RSI, period);
+  if (slot < 0) {
+    outf("{\"error\": \"Invalid indicator or registry full\"}\n");
+    return;
+  }
+  char label[16];
+  indicatorLabel(&indicatorSpecs[slot], label);
+  outf("{\"status\": \"ok\", \"indicator\": \"%s\"}\n", label);
+}
+
+// Step a reverse-scan cursor to the previous entry; false at the start
+bool logPrev(LogSegment **seg, int *idx) {
+  while (*seg && *idx == 0) {
+    *seg = (*seg)->older;
+    if (*seg)
+      *idx = (*seg)->count;
+  }
+  if (!*seg)
+    return false;
+  (*idx)--;
+  return true;
+}
+
+// Newest first: each shard's log is scanned backwards from the end of its
+// newest segment, and merging the cursors by sequence number yields the
+// global order.
+void cmdTransactions() {
+  LogSegment *seg[MAX_SHARDS];
+  int idx[MAX_SHARDS];
+  Transaction *head[MAX_SHARDS];
+  for (int i = 0; i < shardCount; i++) {
+    seg[i] = shards[i].log.newest;
+    idx[i] = seg[i] ? seg[i]->count : 0;
+    head[i] = logPrev(&seg[i], &idx[i]) ? &seg[i]->entries[idx[i]] : NULL;
+  }
+
+  outf("[");
+  for (int count = 0; count < 50; count++) { // Limit to last 50
+    int best = -1;
+    for (int i = 0; i < shardCount; i++)
+      if (head[i] && (best < 0 || head[i]->seq > head[best]->seq))
+        best = i;
+    if (best < 0)
+      break;
+    Transaction *t = head[best];
+    head[best] = logPrev(&seg[best], &idx[best])
+                     ? &seg[best]->entries[idx[best]]
+                     : NULL;
+    outStr(count > 0 ? ",{\"type\": \"" : "{\"type\": \"");
+    outStr(txTypeName(t->type));
+    outStr("\", \"symbol\": \"");
+    outStr(symbolName(t->stock));
+    outStr("\", \"price\": ");
+    outPrice(t->price);
+    outStr("}");
+  }
+  outf("]\n");
+}
+
+// CLUSTERS: the oversold stocks form one cluster once there are two
+void cmdClusters() {
+  int n;
+  Stock **members = oversoldMembers(&n);
+  outf("[");
+  if (n >= 2) {
+    outf("{\"members\": [");
+    for (int i = 0; i < n; i++)
+      outf("%s\"%s\"", i ? ", " : "", symbolName(members[i]->id));
+    outf("]}");
+  }
+  outf("]\n");
+  free(members);
+}
+
+void printRingStats(const char *label, SpscRing *r) {
+  outf("\"%s\": {\"capacity\": %zu, \"depth\": %zu, \"highWater\": %zu, "
+       "\"fullStalls\": %lu, \"emptyStalls\": %lu}",
+       label, r->mask + 1, ringDepth(r), atomic_load(&r->highWater),
+       atomic_load(&r->fullStalls), atomic_load(&r->emptyStalls));
+}
+
+// Resident set size in bytes, -1 where it cannot be read
+long residentBytes() {
+  long pages = -1;
+#ifdef __linux__
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%*d %ld", &pages) != 1)
+      pages = -1;
+    fclose(f);
+  }
+#endif
+  return pages < 0 ? -1 : pages * sysconf(_SC_PAGESIZE);
+}
+
+// One slab pool's counters as a STATS member
+void printPoolStats(const char *name, const SlabPool *p) {
+  outf("\"%s\": {\"live\": %ld, \"slabs\": %d, \"bytes\": %lu, "
+       "\"allocs\": %lu, \"reused\": %lu}",
+       name, p->live, p->slabCount,
+       (unsigned long)(p->slabCount * p->slabElems * p->elemSize), p->allocs,
+       p->reused);
+}
+
+// STATS: pipeline saturation. fullStalls on "ingest" mean the engine is the
+// bottleneck; on "responses" the consumer of stdout is. emptyStalls count
+// the times a stage had to wait for work.
+void cmdStats() {
+  outf("{\"shards\": %d, ", shardCount);
+  printRingStats("ingest", &ingestRing);
+  outf(", ");
+  printRingStats("responses", &responseRing);
+  outf(", \"snapshots\": {\"version\": %lu, \"live\": %d, \"nodes\": %ld}",
+       snapCurrent ? snapCurrent->version : 0, snapLiveVersions(),
+       snapNodePool.live);
+
+  unsigned long entries = 0, dropped = 0, hits = 0, misses = 0;
+  int segments = 0;
+  for (int i = 0; i < shardCount; i++) {
+    hits += shards[i].indicatorHits;
+    misses += shards[i].indicatorMisses;
+    TransactionLog *log = &shards[i].log;
+    for (LogSegment *seg = log->newest; seg; seg = seg->older)
+      entries += seg->count;
+    segments += log->segments;
+    dropped += log->dropped;
+  }
+  outf(", \"log\": {\"entries\": %lu, \"segments\": %d, \"bytes\": %lu, "
+       "\"dropped\": %lu}",
+       entries, segments, (unsigned long)(segments * sizeof(LogSegment)),
+       dropped);
+  outf(", \"indicators\": {\"hits\": %lu, \"misses\": %lu}", hits, misses);
+  SlabPool segmentPools = {0};
+  for (int i = 0; i < shardCount; i++) {
+    SlabPool *p = &shards[i].segments;
+    segmentPools.elemSize = p->elemSize;
+    segmentPools.slabElems = p->slabElems;
+    segmentPools.slabCount += p->slabCount;
+    segmentPools.allocs += p->allocs;
+    segmentPools.reused += p->reused;
+    segmentPools.live += p->live;
+  }
+  outf(", \"memory\": {\"rss\": %ld, ", residentBytes());
+  printPoolStats("stocks", &stockPool);
+  outf(", ");
+  printPoolStats("snapNodes", &snapNodePool);
+  outf(", ");
+  printPoolStats("logSegments", &segmentPools);
+  outf("}");
+  printWalStats();
+  outf("}\n");
+}
+
+QueryKind textQueryKind(const char *cmd) {
+  if (strcmp(cmd, "STOCKS") == 0)
+    return QUERY_STOCKS;
+  if (strcmp(cmd, "SUMMARY") == 0)
+    return QUERY_SUMMARY;
+  if (strcmp(cmd, "TOP") == 0)
+    return QUERY_TOP;
+  return QUERY_NONE;
+}
+
+void execTextQuery(QueryKind kind, Snapshot *snap) {
+  if (kind == QUERY_STOCKS)
+    cmdStocks(snap);
+  else if (kind == QUERY_SUMMARY)
+    cmdSummary(snap);
+  else
+    cmdTop(snap);
+}
+
+// "CMD SYMBOL PRICE [QTY]" arguments; 'qty' keeps its default if absent
+bool parsePriceArgs(const char *buffer, char *name, int64_t *price,
+                    int *qty) {
+  int at = 0;
+  if (sscanf(buffer, "%*s %49s%n", name, &at) < 1)
+    return false;
+  const char *end = priceParse(buffer + at, price);
+  if (!end)
+    return false;
+  sscanf(end, "%d", qty);
+  return true;
+}
+
+// Execute one text command, leaving its JSON response in 'out'
+void execTextCommand(char *buffer) {
+  char cmd[50] = "";
+  char arg1[50] = "";
+  int64_t arg2 = 0;
+  int arg4;
+
+  sscanf(buffer, "%49s", cmd);
+
+  QueryKind query = textQueryKind(cmd);
+  if (query != QUERY_NONE) {
+    // Normally dispatched to a query thread before reaching here
+    Snapshot *snap = snapPublish();
+    if (snap)
+      execTextQuery(query, snap);
+    else
+      outf("{\"error\": \"%s\"}\n", statusMessage(ST_NO_MEMORY));
+  } else if (strcmp(cmd, "SORTED") == 0) {
+    cmdRanked(true, registryCount);
+  } else if (strcmp(cmd, "TOPK") == 0 || strcmp(cmd, "BOTTOMK") == 0) {
+    // TOPK n / BOTTOMK n
+    int k = 10;
+    sscanf(buffer, "%*s %d", &k);
+    cmdRanked(strcmp(cmd, "TOPK") == 0, k);
+  } else if (strcmp(cmd, "SEARCH") == 0) {
+    // SEARCH Prefix [Limit]
+    int limit = 10;
+    sscanf(buffer, "%*s %49s %d", arg1, &limit);
+    cmdSearch(arg1, limit);
+  } else if (strcmp(cmd, "RANK") == 0) {
+    sscanf(buffer, "%*s %49s", arg1);
+    cmdRank(arg1);
+  } else if (strcmp(cmd, "PERCENTILE") == 0) {
+    float p = 50;
+    sscanf(buffer, "%*s %f", &p);
+    cmdPercentile(p);
+  } else if (strcmp(cmd, "ADD") == 0) {
+    // ADD Name Price Qty
+    arg4 = 0;
+    if (!parsePriceArgs(buffer, arg1, &arg2, &arg4)) {
+      outf("{\"error\": \"Invalid ADD arguments\"}\n");
+      return;
+    }
+    Status st = addStock(arg1, arg2, arg4);
+    if (st == ST_OK)
+      outf("{\"status\": \"ok\", \"message\": \"Stock Added\"}\n");
+    else
+      outf("{\"error\": \"%s\"}\n", statusMessage(st));
+  } else if (strcmp(cmd, "UPDATE") == 0) {
+    arg4 = -1; // Default to no quantity update
+    if (!parsePriceArgs(buffer, arg1, &arg2, &arg4)) {
+      outf("{\"error\": \"Invalid UPDATE arguments\"}\n");
+      return;
+    }
+    Status st = updateStockPrice(arg1, arg2, arg4, false);
+    if (st == ST_OK)
+      outf("{\"status\": \"ok\", \"message\": \"Price Updated\"}\n");
+    else
+      outf("{\"error\": \"%s\"}\n", statusMessage(st));
+  } else if (strcmp(cmd, "UPDATEBATCH") == 0) {
+    // The reader parses the tick lines that follow, which only exist in
+    // text mode
+    if (binaryMode) {
+      outf("{\"error\": \"Use the UPDATEBATCH opcode in binary mode\"}\n");
+      return;
+    }
+    cmdUpdateBatch();
+  } else if (strcmp(cmd, "TRENDS") == 0) {
+    // TRENDS Name
+    sscanf(buffer, "%*s %49s", arg1);
+    cmdTrends(arg1);
+  } else if (strcmp(cmd, "INDICATOR") == 0) {
+    // INDICATOR Type Period
+    int period = 0;
+    sscanf(buffer, "%*s %49s %d", arg1, &period);
+    cmdIndicator(arg1, period);
+  } else if (strcmp(cmd, "TRANSACTIONS") == 0) {
+    cmdTransactions();
+  } else if (strcmp(cmd, "CLUSTERS") == 0) {
+    cmdClusters();
+  } else if (strcmp(cmd, "CORR") == 0) {
+    // CORR NameA NameB
+    char arg3[50] = "";
+    sscanf(buffer, "%*s %49s %49s", arg1, arg3);
+    cmdCorr(arg1, arg3);
+  } else if (strcmp(cmd, "CORR_TOP") == 0) {
+    // CORR_TOP Name [K]
+    int k = 10;
+    sscanf(buffer, "%*s %49s %d", arg1, &k);
+    cmdCorrTop(arg1, k);
+  } else if (strcmp(cmd, "CORR_EDGES") == 0) {
+    // CORR_EDGES [Threshold] [Limit]
+    float threshold = 0.8f;
+    int limit = 100;
+    sscanf(buffer, "%*s %f %d", &threshold, &limit);
+    cmdCorrEdges(threshold, limit);
+  } else if (strcmp(cmd, "STATS") == 0) {
+    cmdStats();
+  } else if (strcmp(cmd, "CHECKPOINT") == 0) {
+    cmdCheckpoint();
+  } else if (strcmp(cmd, "RESET") == 0) {
+    engineReset();
+    outf("{\"status\": \"ok\", \"message\": \"Engine reset\"}\n");
+  } else {
+    outf("{\"error\": \"Unknown command\"}\n");
+  }
+}
+
+// Parse the n tick lines behind an UPDATEBATCH, RECORD_TICKS per record
+void readTickLines(int n) {
+  char line[CMD_LINE_LEN];
+  CmdRecord rec = {.kind = REC_TICKS};
+  for (int i = 0; i < n && fgets(line, sizeof(line), stdin); i++) {
+    RecordTick *t = &rec.ticks[rec.count++];
+    if (!parseTickLine(line, t->name, &t->price, &t->qty))
+      t->name[0] = '\0'; // Counted as rejected by the engine
+    if (rec.count == RECORD_TICKS) {
+      ringPush(&ingestRing, &rec);
+      rec.count = 0;
+    }
+  }
+  rec.last = true;
+  ringPush(&ingestRing, &rec);
+}
+
+// Reader stage of the text protocol. Lines may carry a request tag,
+// "#<id> COMMAND ...", which is echoed as "#<id> <json>" so a client can
+// keep many commands in flight and match the responses by ID. Untagged
+// lines get untagged responses.
+void *textReader(void *arg) {
+  (void)arg;
+  char buffer[CMD_LINE_LEN];
+  CmdRecord rec = {.kind = REC_TEXT};
+
+  while (fgets(buffer, sizeof(buffer), stdin)) {
+    // Remove newline
+    buffer[strcspn(buffer, "\n")] = 0;
+    char *line = buffer;
+    rec.tagged = line[0] == '#';
+    rec.id = 0;
+    if (rec.tagged) {
+      char *end;
+      rec.id = strtoul(line + 1, &end, 10);
+      line = end;
+    }
+    strcpy(rec.line, line);
+    ringPush(&ingestRing, &rec);
+
+    char cmd[50] = "";
+    int n = 0;
+    if (sscanf(line, "%49s %d", cmd, &n) >= 1 &&
+        strcmp(cmd, "UPDATEBATCH") == 0)
+      readTickLines(n);
+  }
+  rec.kind = REC_END;
+  ringPush(&ingestRing, &rec);
+  return NULL;
+}
+
+int runApiMode() { return runPipeline(textReader); }
+
+/* ================= BINARY PROTOCOL ================= */
+// Opt-in with --api=binary. All multi-byte fields are little-endian.
+//   Request : u32 length | u32 requestId | u8 opcode | payload
+//   Response: u32 length | u32 requestId | u8 type   | payload
+// 'length' counts everything after itself. The response echoes the request
+// ID so the client can pipeline frames and match replies by ID.
+// Prices and money totals are i64 ticks (1/PRICE_SCALE rupee), as stored.
+// Tick record (ADD, UPDATE, UPDATEBATCH), 32 bytes:
+//   char name[20] (NUL padded) | i64 price | i32 qty (<= 0 keeps quantity)
+// Stock record (STOCKS, TOP), 68 bytes:
+//   char name[20] | i64 buyPrice | i64 currentPrice | i32 quantity
+//   | f32 percentGain | f32 sma | f32 rsi | i64 upperAlert | i64 lowerAlert
+// OP_HELLO reports the layout version and the price scale; a client built
+// for another version is refused.
+// OP_TEXT carries any text command line and answers with RESP_JSON, so every
+// command stays reachable while the hot paths avoid text entirely.
+
+#define PROTOCOL_VERSION 2 // Bumped whenever a frame layout changes
+
+#define OP_ADD 1
+#define OP_UPDATE 2
+#define OP_UPDATEBATCH 3 // u32 count | count tick records
+#define OP_STOCKS 4
+#define OP_SUMMARY 5
+#define OP_TOP 6
+#define OP_HELLO 7 // u32 client protocol version
+#define OP_TEXT 0x7F
+
+// STOCKS, SUMMARY and TOP are served from a snapshot and start with the
+// u64 version they reflect.
+#define RESP_OK 0     // u32 applied | u32 rejected
+#define RESP_ERROR 1  // UTF-8 message
+#define RESP_STOCKS 2 // u64 version | u32 count | count stock records
+#define RESP_SUMMARY 3 // u64 version | i64 investment | i64 value
+                       // | i64 profit | u32 count
+#define RESP_TOP 4   // u64 version | u8 present | [gainer rec | loser rec]
+#define RESP_JSON 5  // JSON text
+#define RESP_HELLO 6 // u32 protocol version | u32 price scale
+
+#define TICK_RECORD_SIZE 32
+#define STOCK_RECORD_SIZE 68
+#define FRAME_HEADER_SIZE 9 // length + requestId + type
+#define MAX_FRAME_SIZE (64u << 20)
+
+_Thread_local uint32_t frameRequestId = 0; // Request being answered
+
+uint32_t getU32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+uint64_t getU64(const uint8_t *p) {
+  return (uint64_t)getU32(p) | (uint64_t)getU32(p + 4) << 32;
+}
+
+// A price field in ticks; false if it is out of range
+bool getPrice(const uint8_t *p, int64_t *ticks) {
+  int64_t v = (int64_t)getU64(p);
+  if (v < -PRICE_MAX || v > PRICE_MAX)
+    return false;
+  *ticks = v;
+  return true;
+}
+
+void outU32(uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                  (uint8_t)(v >> 24)};
+  outBytes(b, 4);
+}
+
+void outF32(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  outU32(bits);
+}
+
+void outU64(uint64_t v) {
+  outU32((uint32_t)v);
+  outU32((uint32_t)(v >> 32));
+}
+
+void outI64(int64_t v) { outU64((uint64_t)v); }
+
+// Start a response frame; the length is patched in by frameEnd()
+void frameBegin(uint8_t type) {
+  out.len = 0;
+  outU32(0);
+  outU32(frameRequestId);
+  outBytes(&type, 1);
+}
+
+void frameEnd() {
+  if (out.len < FRAME_HEADER_SIZE)
+    return; // Allocation failed while building the frame
+  uint32_t len = (uint32_t)(out.len - 4);
+  uint8_t b[4] = {(uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16),
+                  (uint8_t)(len >> 24)};
+  memcpy(out.data, b, 4);
+}
+
+void frameError(const char *msg) {
+  frameBegin(RESP_ERROR);
+  outBytes(msg, strlen(msg));
+}
+
+void frameOk(uint32_t applied, uint32_t rejected) {
+  frameBegin(RESP_OK);
+  outU32(applied);
+  outU32(rejected);
+}
+
+// Copy the fixed-width name field into a NUL-terminated string
+void readRecordName(const uint8_t *p, char *name) {
+  memcpy(name, p, NAME_LEN);
+  name[NAME_LEN - 1] = '\0';
+}
+
+void outViewRecord(const StockView *v) {
+  outBytes(symbolName(v->stock), NAME_LEN); // Interned names are NUL padded
+  outI64(v->buyPrice);
+  outI64(v->currentPrice);
+  outU32((uint32_t)v->quantity);
+  outF32(v->percentGain);
+  outF32(v->sma);
+  outF32(v->rsi);
+  outI64(v->upperAlert);
+  outI64(v->lowerAlert);
+}
+
+void outSnapRecords(SnapNode *n) {
+  if (n) {
+    outSnapRecords(n->left);
+    outViewRecord(&n->view);
+    outSnapRecords(n->right);
+  }
+}
+
+// Snapshot reads; like their text forms they may run on a query thread
+void snapFrame(uint8_t op, Snapshot *snap) {
+  switch (op) {
+  case OP_STOCKS:
+    frameBegin(RESP_STOCKS);
+    outU64(snap->version);
+    outU32((uint32_t)snap->count);
+    outSnapRecords(snap->root);
+    return;
+  case OP_SUMMARY: {
+    uint64_t invest = snap->root ? snap->root->invest : 0;
+    uint64_t value = snap->root ? snap->root->value : 0;
+    frameBegin(RESP_SUMMARY);
+    outU64(snap->version);
+    outI64((int64_t)invest);
+    outI64((int64_t)value);
+    outI64((int64_t)(value - invest));
+    outU32((uint32_t)snap->count);
+    return;
+  }
+  case OP_TOP: {
+    uint8_t present = snap->hasTop;
+    frameBegin(RESP_TOP);
+    outU64(snap->version);
+    outBytes(&present, 1);
+    if (present) {
+      outViewRecord(&snap->topGainer);
+      outViewRecord(&snap->topLoser);
+    }
+    return;
+  }
+  }
+}
 
-  // Identify correlations
-  for (int i = 0; i < registryCount; i++) {
-    if (calculateRSI(stockRegistry[i], 14) < 30) {
-      for (int j = 0; j < registryCount; j++) {
-        if (i == j)
-          continue;
-        if (calculateRSI(stockRegistry[j], 14) < 30) {
-          correlationGraph[i][j] = 1;
-        }
-      }
+void execBinaryFrame(CmdRecord *rec) {
+  uint8_t op = rec->op;
+  const uint8_t *p = rec->payload;
+  uint32_t len = rec->count;
+  char name[NAME_LEN];
+
+  switch (op) {
+  case OP_ADD:
+  case OP_UPDATE: {
+    if (len != TICK_RECORD_SIZE) {
+      frameError("Bad tick record");
+      return;
+    }
+    readRecordName(p, name);
+    int64_t price;
+    if (!getPrice(p + NAME_LEN, &price)) {
+      frameError("Bad price");
+      return;
+    }
+    int qty = (int32_t)getU32(p + NAME_LEN + 8);
+    Status st = op == OP_ADD ? addStock(name, price, qty)
+                             : updateStockPrice(name, price, qty, false);
+    if (st == ST_OK)
+      frameOk(1, 0);
+    else
+      frameError(statusMessage(st));
+    return;
+  }
+  case OP_UPDATEBATCH: {
+    // The reader checked the length and streams the ticks behind this record
+    if (!rec->ticksFollow) {
+      frameError("Bad batch length");
+      return;
+    }
+    int rejected = 0;
+    int queued = queueBatchRecords(&rejected);
+    int applied = batchApply();
+    frameOk((uint32_t)applied, (uint32_t)(rejected + queued - applied));
+    return;
+  }
+  case OP_STOCKS:
+  case OP_SUMMARY:
+  case OP_TOP: {
+    // Normally dispatched to a query thread before reaching here
+    Snapshot *snap = snapPublish();
+    if (snap)
+      snapFrame(op, snap);
+    else
+      frameError(statusMessage(ST_NO_MEMORY));
+    return;
+  }
+  case OP_HELLO:
+    if (len != 4 || getU32(p) != PROTOCOL_VERSION) {
+      frameError("Unsupported protocol version");
+      return;
+    }
+    frameBegin(RESP_HELLO);
+    outU32(PROTOCOL_VERSION);
+    outU32(PRICE_SCALE);
+    return;
+  case OP_TEXT: {
+    char line[256];
+    uint32_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+    memcpy(line, p, n);
+    line[n] = '\0';
+    frameBegin(RESP_JSON);
+    execTextCommand(line);
+    if (out.len > FRAME_HEADER_SIZE && out.data[out.len - 1] == '\n')
+      out.len--; // Frames are self-delimiting
+    return;
+  }
+  default:
+    frameError("Unknown opcode");
+  }
+}
+
+// Discard the unread rest of a frame
+bool skipBytes(uint32_t n) {
+  uint8_t scratch[CMD_LINE_LEN];
+  while (n > 0) {
+    uint32_t chunk = n < sizeof(scratch) ? n : sizeof(scratch);
+    if (fread(scratch, 1, chunk, stdin) != chunk)
+      return false;
+    n -= chunk;
+  }
+  return true;
+}
+
+// Stream n tick records from stdin into REC_TICKS records
+bool readTickFrames(uint32_t n) {
+  uint8_t buf[TICK_RECORD_SIZE];
+  CmdRecord rec = {.kind = REC_TICKS};
+  bool ok = true;
+  for (uint32_t i = 0; i < n; i++) {
+    if (fread(buf, 1, TICK_RECORD_SIZE, stdin) != TICK_RECORD_SIZE) {
+      ok = false;
+      break;
+    }
+    RecordTick *t = &rec.ticks[rec.count++];
+    readRecordName(buf, t->name);
+    if (!getPrice(buf + NAME_LEN, &t->price))
+      t->name[0] = '\0'; // Rejected like a malformed tick line
+    t->qty = (int32_t)getU32(buf + NAME_LEN + 8);
+    if (rec.count == RECORD_TICKS) {
+      ringPush(&ingestRing, &rec);
+      rec.count = 0;
+    }
+  }
+  rec.last = true; // Always close the batch so the engine can answer it
+  ringPush(&ingestRing, &rec);
+  return ok;
+}
+
+// Reader stage of the binary protocol. Frames are decoded straight from
+// stdin, so even a large UPDATEBATCH is never buffered whole.
+void *binaryReader(void *arg) {
+  (void)arg;
+  uint8_t header[9]; // length | requestId | opcode
+  CmdRecord rec = {.kind = REC_FRAME};
+
+  while (fread(header, 1, 9, stdin) == 9) {
+    uint32_t len = getU32(header);
+    if (len < 5 || len > MAX_FRAME_SIZE)
+      break; // Stream is out of sync; let the supervisor restart us
+    uint32_t rest = len - 5;
+    rec.id = getU32(header + 4);
+    rec.op = header[8];
+    rec.count = 0;
+    rec.ticksFollow = false;
+
+    if (rec.op == OP_UPDATEBATCH && rest >= 4) {
+      uint8_t nb[4];
+      if (fread(nb, 1, 4, stdin) != 4)
+        break;
+      uint32_t n = getU32(nb);
+      rest -= 4;
+      rec.ticksFollow = (uint64_t)n * TICK_RECORD_SIZE == rest;
+      ringPush(&ingestRing, &rec);
+      if (rec.ticksFollow ? !readTickFrames(n) : !skipBytes(rest))
+        break;
+      continue;
+    }
+    rec.count = rest < CMD_LINE_LEN ? rest : CMD_LINE_LEN;
+    if (fread(rec.payload, 1, rec.count, stdin) != rec.count ||
+        !skipBytes(rest - rec.count))
+      break;
+    ringPush(&ingestRing, &rec);
+  }
+  rec.kind = REC_END;
+  ringPush(&ingestRing, &rec);
+  return NULL;
+}
+
+int runBinaryApiMode() {
+  binaryMode = true;
+#ifdef _WIN32
+  _setmode(_fileno(stdin), _O_BINARY);
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  return runPipeline(binaryReader);
+}
+
+/* ================= PERSISTENCE (WAL + CHECKPOINTS) ================= */
+// With --data-dir, every ADD, UPDATE, batch tick and INDICATOR is appended
+// to a write-ahead log. The engine stages a command's records and submits
+// them together with its response. The flusher thread writes and syncs
+// everything submitted since its last sync in one go (group commit), and
+// the writer holds each response back until its records are durable.
+// Every checkpointEvery records (or checkpointInterval seconds) the engine
+// switches to a new log file (wal.<gen>) and forks: the child writes the
+// state as of the fork from its copy-on-write view of memory while the
+// engine keeps serving. Recovery loads the checkpoint and replays only the
+// logs written after it.
+
+char *dataDir = NULL; // NULL: persistence off
+unsigned long checkpointEvery = CHECKPOINT_EVERY;
+double checkpointInterval = 0;   // Seconds between checkpoints, 0: off
+bool walEnabled = false;         // Logging is running (engine only)
+unsigned long walGen = 1;        // Log file being appended to
+unsigned long checkpointGen = 1; // First log file the checkpoint does not cover
+unsigned long walSinceCheckpoint = 0;
+unsigned long checkpoints = 0;
+unsigned long checkpointsFailed = 0;
+double checkpointMs = 0;     // Duration of the last checkpoint
+double checkpointForkMs = 0; // Engine stall of the last fork
+double checkpointLast = 0;   // nowNs() when the last checkpoint began
+OutBuf walStaged = {0};      // Records of the current command (engine only)
+unsigned long walSubmitted = 0; // Log bytes handed to the flusher
+
+// Background checkpoint (engine only)
+pid_t ckptPid = 0;         // Running child, 0 if none
+unsigned long ckptGen = 0; // First log file the running one does not cover
+double ckptPollAt = 0;     // Next time to check on the child
+CheckpointProgress *ckptProgress = NULL; // Shared with the child
+char ckptBuf[CHECKPOINT_BUFFER]; // Static, so the child never allocates
+size_t ckptBuffered = 0;         // Bytes in ckptBuf not yet written
+bool ckptWriteOk = true;         // No write of the current image failed
+
+// Shared with the flusher (under walLock)
+pthread_mutex_t walLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t walWork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t walSynced = PTHREAD_COND_INITIALIZER;
+int walFd = -1;           // Log file the flusher writes to
+int walNextFd = -1;       // Log file to continue in, from walRotateAt on
+unsigned long walRotateAt = 0;
+OutBuf walPending = {0};  // Submitted, not yet written
+unsigned long walSyncs = 0;
+bool walStop = false;
+atomic_bool walBroken;   // A write failed; logging has stopped
+atomic_ulong walDurable; // Log bytes known to be on disk
+pthread_t walThread;
+
+void makeDataDir() {
+#ifdef _WIN32
+  mkdir(dataDir);
+#else
+  mkdir(dataDir, 0755);
+#endif
+}
+
+void dataPath(char *path, const char *name, unsigned long gen) {
+  if (gen)
+    snprintf(path, DATA_PATH_LEN, "%s/%s.%lu", dataDir, name, gen);
+  else
+    snprintf(path, DATA_PATH_LEN, "%s/%s", dataDir, name);
+}
+
+int syncFile(int fd) {
+#ifdef _WIN32
+  return _commit(fd);
+#elif defined(__linux__)
+  return fdatasync(fd);
+#else
+  return fsync(fd);
+#endif
+}
+
+// Make a rename or a new file in the data directory durable
+void syncDataDir() {
+#ifndef _WIN32
+  int fd = open(dataDir, O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+#endif
+}
+
+bool writeAll(int fd, const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return false;
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+uint32_t walChecksum(const WalRecord *r) {
+  const unsigned char *p = (const unsigned char *)r;
+  uint32_t h = 2166136261u;
+  for (size_t i = sizeof(r->check); i < sizeof(WalRecord); i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+// Stop logging for good; responses are no longer held back (walLock held)
+void walBreak(const char *why) {
+  if (!atomic_load(&walBroken))
+    fprintf(stderr, "WAL disabled: %s\n", why);
+  atomic_store(&walBroken, true);
+  atomic_store(&walDurable, ULONG_MAX);
+  pthread_cond_broadcast(&walSynced);
+}
+
+// Stage one record of the current command (engine thread)
+void walLog(WalType type, const char *name, int64_t price, int value) {
+  if (!walEnabled || atomic_load(&walBroken))
+    return;
+  WalRecord r;
+  memset(&r, 0, sizeof(r));
+  r.type = (uint8_t)type;
+  r.price = price;
+  r.value = value;
+  if (name)
+    strncpy(r.name, name, NAME_LEN - 1);
+  r.check = walChecksum(&r);
+  if (!bufReserve(&walStaged, sizeof(r))) {
+    pthread_mutex_lock(&walLock);
+    walBreak("out of memory");
+    pthread_mutex_unlock(&walLock);
+    return;
+  }
+  memcpy(walStaged.data + walStaged.len, &r, sizeof(r));
+  walStaged.len += sizeof(r);
+  walSinceCheckpoint++;
+}
+
+// Hand the current command's records to the flusher. Returns the log
+// position its response has to wait for.
+unsigned long walSubmit() {
+  if (walStaged.len == 0)
+    return walSubmitted;
+  size_t n = walStaged.len;
+  pthread_mutex_lock(&walLock);
+  if (walPending.len == 0) {
+    OutBuf t = walPending; // Flusher is idle or busy syncing: swap buffers
+    walPending = walStaged;
+    walStaged = t;
+  } else if (bufReserve(&walPending, n)) {
+    memcpy(walPending.data + walPending.len, walStaged.data, n);
+    walPending.len += n;
+  } else {
+    walBreak("out of memory");
+  }
+  walSubmitted += n;
+  walStaged.len = 0;
+  pthread_cond_signal(&walWork);
+  pthread_mutex_unlock(&walLock);
+  return walSubmitted;
+}
+
+// Flusher: one write and one sync for everything submitted meanwhile. A
+// pending log switch splits the buffer at walRotateAt.
+void *walFlusher(void *arg) {
+  (void)arg;
+  OutBuf buf = {0};
+  pthread_mutex_lock(&walLock);
+  unsigned long taken = walSubmitted; // Log position buf starts at
+  for (;;) {
+    while (walPending.len == 0 && walNextFd < 0 && !walStop)
+      pthread_cond_wait(&walWork, &walLock);
+    if (walPending.len == 0 && walNextFd < 0)
+      break;
+    OutBuf t = walPending;
+    walPending = buf;
+    buf = t;
+    unsigned long end = walSubmitted;
+    int fd = walFd, next = walNextFd;
+    size_t head = next >= 0 ? (size_t)(walRotateAt - taken) : buf.len;
+    pthread_mutex_unlock(&walLock);
+
+    bool ok = writeAll(fd, buf.data, head) && syncFile(fd) == 0;
+    if (next >= 0) {
+      close(fd);
+      syncDataDir(); // The new file's directory entry
+      ok = ok && writeAll(next, buf.data + head, buf.len - head) &&
+           syncFile(next) == 0;
+    }
+    taken = end;
+    buf.len = 0;
+
+    pthread_mutex_lock(&walLock);
+    if (next >= 0) {
+      walFd = next;
+      walNextFd = -1;
+    }
+    walSyncs++;
+    if (!ok) {
+      walBreak(strerror(errno));
+      continue;
     }
+    if (!atomic_load(&walBroken))
+      atomic_store(&walDurable, end);
+    pthread_cond_broadcast(&walSynced);
+  }
+  pthread_mutex_unlock(&walLock);
+  free(buf.data);
+  return NULL;
+}
+
+void walWaitDurable(unsigned long lsn) {
+  if (atomic_load(&walDurable) >= lsn)
+    return;
+  pthread_mutex_lock(&walLock);
+  while (atomic_load(&walDurable) < lsn)
+    pthread_cond_wait(&walSynced, &walLock);
+  pthread_mutex_unlock(&walLock);
+}
+
+// Continue in the next log file after everything submitted so far. The
+// flusher makes the switch, so the engine does not wait for a sync.
+bool walRotate() {
+  walSubmit();
+  char path[DATA_PATH_LEN];
+  dataPath(path, "wal", walGen + 1);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_BINARY, 0644);
+  if (fd < 0)
+    return false;
+  pthread_mutex_lock(&walLock);
+  while (walNextFd >= 0) // The previous switch is still pending
+    pthread_cond_wait(&walSynced, &walLock);
+  walNextFd = fd;
+  walRotateAt = walSubmitted;
+  pthread_cond_signal(&walWork);
+  pthread_mutex_unlock(&walLock);
+  walGen++;
+  return true;
+}
+
+uint64_t imageAlign(uint64_t off) { return (off + 63) & ~(uint64_t)63; }
+
+void imageFlush(int fd) {
+  if (ckptBuffered && !writeAll(fd, ckptBuf, ckptBuffered))
+    ckptWriteOk = false;
+  ckptBuffered = 0;
+}
+
+// Buffered write(); sections larger than the buffer go straight out
+void imageWrite(int fd, uint64_t *pos, const void *p, size_t n) {
+  if (ckptBuffered + n > sizeof(ckptBuf))
+    imageFlush(fd);
+  if (n >= sizeof(ckptBuf)) {
+    if (!writeAll(fd, p, n))
+      ckptWriteOk = false;
+  } else {
+    memcpy(ckptBuf + ckptBuffered, p, n);
+    ckptBuffered += n;
   }
+  *pos += n;
+  if (ckptProgress)
+    atomic_store_explicit(&ckptProgress->written, *pos, memory_order_relaxed);
+}
+
+// Zero-fill up to the start of the next section
+void imagePad(int fd, uint64_t *pos, uint64_t to) {
+  static const char zero[64];
+  while (*pos < to)
+    imageWrite(fd, pos, zero,
+               to - *pos < sizeof(zero) ? (size_t)(to - *pos) : sizeof(zero));
+}
 
-  // 2. Identify and output clusters
-  printf("[");
-  bool firstCluster = true;
-  bool visited[MAX_STOCKS] = {0};
+// Engine thread, before an image is written: finish any hash table
+// migration (the image holds one table per shard) and name the files
+void checkpointPrepare(char *tmp, char *path) {
+  for (int i = 0; i < shardCount; i++)
+    htMigrate(&shards[i], UINT32_MAX);
+  dataPath(tmp, "checkpoint.tmp", 0);
+  dataPath(path, "checkpoint", 0);
+}
 
+// Write the full state as a mappable image to 'path', via 'tmp' and a
+// rename. Only system calls and memory copies (no malloc, no stdio), so a
+// forked child can run it whatever locks the other threads held.
+bool checkpointSave(const char *tmp, const char *path) {
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd < 0)
+    return false;
+  ckptBuffered = 0;
+  ckptWriteOk = true;
+
+  CheckpointHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DSA2IMG", 8);
+  h.format = CHECKPOINT_FORMAT;
+  h.stockSize = sizeof(Stock);
+  h.priceScale = PRICE_SCALE;
+  h.stockCount = (uint32_t)registryCount;
+  h.indicatorCount = (uint32_t)indicatorCount;
+  h.shardCount = (uint32_t)shardCount;
+  memcpy(h.indicators, indicatorSpecs, sizeof(indicatorSpecs));
+  h.walGen = walGen;
+  h.transSeq = transSeq;
+
+  // Lay out the sections
+  uint64_t off = imageAlign(sizeof(h));
+  h.symbolsOffset = off;
+  off = imageAlign(off + (uint64_t)registryCount * sizeof(Symbol));
+  h.stocksOffset = off;
+  off = imageAlign(off + (uint64_t)registryCount * sizeof(Stock));
+  h.hotOffset = off;
+  off = imageAlign(off + (uint64_t)registryCount * HOT_IMAGE_BYTES);
+  for (int i = 0; i < shardCount; i++) {
+    Shard *sh = &shards[i];
+    ShardImage *si = &h.shards[i];
+    si->tableMask = sh->table.slots ? sh->table.mask : 0;
+    si->tableSize = sh->table.size;
+    si->slotsOffset = off;
+    off = imageAlign(off + (uint64_t)(sh->table.slots ? si->tableMask + 1 : 0) *
+                               sizeof(HashSlot));
+    si->rankCount = sh->rankCount;
+    si->rankRoot = sh->rankRoot;
+    si->rankOffset = off;
+    off = imageAlign(off + (uint64_t)sh->rankCount * sizeof(RankNode));
+    si->heapSize = sh->heapSize;
+    si->oversoldCount = sh->oversold.count;
+    si->heapsOffset = off;
+    off = imageAlign(off + (uint64_t)(sh->heapSize * 2 + sh->oversold.count) *
+                               sizeof(uint32_t));
+  }
+  LogSegment *seg[MAX_SHARDS];
+  int idx[MAX_SHARDS];
+  for (int i = 0; i < shardCount; i++) {
+    seg[i] = shards[i].log.oldest;
+    idx[i] = 0;
+    for (LogSegment *g = seg[i]; g; g = g->newer)
+      h.transactionCount += g->count;
+  }
+  h.transactionsOffset = off;
+  if (ckptProgress)
+    atomic_store(&ckptProgress->total,
+                 off + (uint64_t)h.transactionCount * sizeof(Transaction));
+
+  uint64_t pos = 0;
+  imageWrite(fd, &pos, &h, sizeof(h));
+  imagePad(fd, &pos, h.symbolsOffset);
+  for (int i = 0; i < registryCount; i++)
+    imageWrite(fd, &pos, symbolAt(i), sizeof(Symbol));
+  imagePad(fd, &pos, h.stocksOffset);
   for (int i = 0; i < registryCount; i++) {
-    if (!visited[i] && calculateRSI(stockRegistry[i], 14) < 30) {
-      bool clusterFound = false;
-
-      // Check if this stock has any connections
-      for (int j = 0; j < registryCount; j++) {
-        if (correlationGraph[i][j]) {
-          clusterFound = true;
-          break;
-        }
-      }
+    Stock c = *stockRegistry[i];
+    c.inBatch = c.snapDirty = false; // Runtime-only flags
+    imageWrite(fd, &pos, &c, sizeof(c));
+  }
+  imagePad(fd, &pos, h.hotOffset);
+  imageWrite(fd, &pos, hot.price, registryCount * sizeof(int64_t));
+  imageWrite(fd, &pos, hot.buy, registryCount * sizeof(int64_t));
+  imageWrite(fd, &pos, hot.gain, registryCount * sizeof(float));
+  imageWrite(fd, &pos, hot.quantity, registryCount * sizeof(int));
+  for (int i = 0; i < shardCount; i++) {
+    Shard *sh = &shards[i];
+    ShardImage *si = &h.shards[i];
+    imagePad(fd, &pos, si->slotsOffset);
+    if (sh->table.slots)
+      imageWrite(fd, &pos, sh->table.slots,
+                 ((size_t)sh->table.mask + 1) * sizeof(HashSlot));
+    imagePad(fd, &pos, si->rankOffset);
+    imageWrite(fd, &pos, sh->rankPool, (size_t)sh->rankCount * sizeof(RankNode));
+    imagePad(fd, &pos, si->heapsOffset);
+    for (int j = 0; j < sh->heapSize; j++) {
+      uint32_t id = (uint32_t)sh->maxHeap[j].id;
+      imageWrite(fd, &pos, &id, sizeof(id));
+    }
+    for (int j = 0; j < sh->heapSize; j++) {
+      uint32_t id = (uint32_t)sh->minHeap[j].id;
+      imageWrite(fd, &pos, &id, sizeof(id));
+    }
+    for (int j = 0; j < sh->oversold.count; j++) {
+      uint32_t id = (uint32_t)sh->oversold.members[j]->id;
+      imageWrite(fd, &pos, &id, sizeof(id));
+    }
+  }
 
-      // If it's part of a cluster (has connections), output it
-      if (clusterFound) {
-        if (!firstCluster)
-          printf(",");
-        printf("{\"members\": [\"%s\"", stockRegistry[i]->name);
-        visited[i] = true;
-
-        for (int j = 0; j < registryCount; j++) {
-          if (correlationGraph[i][j] && !visited[j]) {
-            printf(", \"%s\"", stockRegistry[j]->name);
-            visited[j] = true;
-          }
-        }
-        printf("]}");
-        firstCluster = false;
+  // Oldest first across shards, so a load can re-append in order to
+  // whatever shard layout it runs with
+  imagePad(fd, &pos, h.transactionsOffset);
+  for (;;) {
+    int best = -1;
+    for (int i = 0; i < shardCount; i++) {
+      while (seg[i] && idx[i] == seg[i]->count) {
+        seg[i] = seg[i]->newer;
+        idx[i] = 0;
       }
+      if (seg[i] && (best < 0 || seg[i]->entries[idx[i]].seq <
+                                     seg[best]->entries[idx[best]].seq))
+        best = i;
     }
+    if (best < 0)
+      break;
+    imageWrite(fd, &pos, &seg[best]->entries[idx[best]++], sizeof(Transaction));
+  }
+
+  imageFlush(fd);
+  bool ok = ckptWriteOk && syncFile(fd) == 0;
+  ok = close(fd) == 0 && ok;
+#ifdef _WIN32
+  if (ok)
+    remove(path); // rename() does not replace on Windows
+#endif
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return false;
   }
-  printf("]\n");
+  syncDataDir();
+  return true;
 }
 
-void runApiMode() {
-  char buffer[256];
-  char cmd[50];
-  char arg1[50];
-  float arg2, arg3;
-  int arg4;
+// A checkpoint covering the logs before 'gen' is in place: drop them
+void checkpointDone(unsigned long gen) {
+  char path[DATA_PATH_LEN];
+  for (; checkpointGen < gen; checkpointGen++) {
+    dataPath(path, "wal", checkpointGen);
+    remove(path);
+  }
+  checkpoints++;
+}
 
-  // Flush immediately on start to signal ready? No, just loop.
+// Reap a finished background checkpoint, at most once a millisecond
+// unless 'wait' blocks until it is done. True while one is still running.
+bool checkpointPoll(bool wait) {
+#ifndef _WIN32
+  if (!ckptPid || (!wait && nowNs() < ckptPollAt))
+    return ckptPid != 0;
+  ckptPollAt = nowNs() + 1e6;
+  int status = 0;
+  pid_t r;
+  do
+    r = waitpid(ckptPid, &status, wait ? 0 : WNOHANG);
+  while (r < 0 && errno == EINTR);
+  if (r == 0)
+    return true;
+  ckptPid = 0;
+  checkpointMs = (nowNs() - checkpointLast) / 1e6;
+  if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    checkpointDone(ckptGen);
+  } else {
+    checkpointsFailed++;
+    fprintf(stderr, "Background checkpoint failed\n");
+  }
+#else
+  (void)wait;
+#endif
+  return false;
+}
 
-  while (fgets(buffer, sizeof(buffer), stdin)) {
-    // Remove newline
-    buffer[strcspn(buffer, "\n")] = 0;
+// Start a new log file and checkpoint the state up to it on the engine
+// thread; the older logs are then redundant. Used at shutdown.
+bool checkpoint() {
+  checkpointPoll(true); // A background one must not write concurrently
+  checkpointLast = nowNs();
+  char tmp[DATA_PATH_LEN], path[DATA_PATH_LEN];
+  checkpointPrepare(tmp, path);
+  bool ok = (!walEnabled || walRotate()) && checkpointSave(tmp, path);
+  if (ok) {
+    checkpointDone(walGen);
+  } else {
+    checkpointsFailed++;
+    fprintf(stderr, "Checkpoint failed: %s\n", strerror(errno));
+  }
+  walSinceCheckpoint = 0;
+  checkpointMs = (nowNs() - checkpointLast) / 1e6;
+  return ok;
+}
 
-    // Basic parsing
-    int parts =
-        sscanf(buffer, "%s %s %f %f %d", cmd, arg1, &arg2, &arg3, &arg4);
-
-    if (strcmp(cmd, "STOCKS") == 0 || strcmp(cmd, "SORTED") == 0) {
-      cmdStocks();
-    } else if (strcmp(cmd, "ADD") == 0) {
-      // arg1=Name, arg2=BuyPrice, arg4=Qty (arg3 ignored if not needed, let's
-      // strictly follow sscanf) Re-parse for specific ADD signature: ADD Name
-      // Price Qty
-      sscanf(buffer, "%s %s %f %d", cmd, arg1, &arg2, &arg4);
-      addStock(arg1, arg2, arg4);
-      printf("{\"status\": \"ok\", \"message\": \"Stock Added\"}\n");
-    } else if (strcmp(cmd, "UPDATE") == 0) {
-      arg4 = -1; // Default to no quantity update
-      int n = sscanf(buffer, "%s %s %f %d", cmd, arg1, &arg2, &arg4);
-      if (n >= 3) {
-        updateStockPrice(arg1, arg2, arg4, false);
-        printf("{\"status\": \"ok\", \"message\": \"Price Updated\"}\n");
-      } else {
-        printf("{\"error\": \"Invalid UPDATE arguments\"}\n");
-      }
-    } else if (strcmp(cmd, "SUMMARY") == 0) {
-      cmdSummary();
-    } else if (strcmp(cmd, "TOP") == 0) {
-      cmdTop();
-    } else if (strcmp(cmd, "TRENDS") == 0) {
-      // TRENDS Name
-      sscanf(buffer, "%s %s", cmd, arg1);
-      cmdTrends(arg1);
-    } else if (strcmp(cmd, "TRANSACTIONS") == 0) {
-      cmdTransactions();
-    } else if (strcmp(cmd, "CLUSTERS") == 0) {
-      cmdClusters();
+// Start a new log file and fork a child that checkpoints the state up to
+// it. The engine only pays for the fork (copying page tables) and for the
+// copy-on-write faults of pages it modifies while the child runs. False
+// if a checkpoint is already running or the fork failed.
+bool checkpointStart() {
+  if (checkpointPoll(false))
+    return false;
+#ifdef _WIN32
+  return checkpoint(); // No fork: write it on the engine thread
+#else
+  if (!ckptProgress) {
+    void *p = mmap(NULL, sizeof(CheckpointProgress), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      return checkpoint();
+    ckptProgress = (CheckpointProgress *)p;
+  }
+  if (walEnabled && !walRotate()) {
+    checkpointsFailed++;
+    fprintf(stderr, "Checkpoint failed: %s\n", strerror(errno));
+    return false;
+  }
+  atomic_store(&ckptProgress->written, 0);
+  atomic_store(&ckptProgress->total, 0);
+  checkpointLast = nowNs();
+  char tmp[DATA_PATH_LEN], path[DATA_PATH_LEN];
+  checkpointPrepare(tmp, path);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Only this thread exists in the child, and the others may have held
+    // any lock (malloc's, stdio's) at the fork: checkpointSave takes none
+    int prio = nice(CHECKPOINT_NICE); // Best effort
+    (void)prio;
+    _exit(checkpointSave(tmp, path) ? 0 : 1);
+  }
+  checkpointForkMs = (nowNs() - checkpointLast) / 1e6;
+  walSinceCheckpoint = 0;
+  if (pid < 0) {
+    checkpointsFailed++;
+    fprintf(stderr, "Checkpoint failed: %s\n", strerror(errno));
+    return false;
+  }
+  ckptPid = pid;
+  ckptGen = walGen;
+  ckptPollAt = 0;
+  return true;
+#endif
+}
+
+// Engine thread, after each command: reap or start a background checkpoint
+void checkpointTick() {
+  if (ckptPid)
+    checkpointPoll(false);
+  else if (walSinceCheckpoint >= checkpointEvery ||
+           (checkpointInterval > 0 && walSinceCheckpoint > 0 &&
+            nowNs() - checkpointLast >= checkpointInterval * 1e9))
+    checkpointStart();
+}
+
+// The loaded checkpoint: its stocks are used in place, so it stays mapped
+// until a RESET drops them
+char *imageBase = NULL;
+uint64_t imageBytes = 0;
+
+void imageRelease() {
+  if (!imageBase)
+    return;
+#ifdef _WIN32
+  free(imageBase);
+#else
+  munmap(imageBase, imageBytes);
+#endif
+  imageBase = NULL;
+}
+
+// Map the whole file (private, copy-on-write); NULL on failure
+char *imageMap(const char *path, uint64_t *size) {
+  int fd = open(path, O_RDONLY | O_BINARY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  char *base = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    *size = (uint64_t)st.st_size;
+#ifdef _WIN32
+    base = (char *)malloc(*size); // No mmap: read it in instead
+    if (base && read(fd, base, (unsigned)*size) != (int)*size) {
+      free(base);
+      base = NULL;
+    }
+#else
+    base = (char *)mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                        0);
+    if (base == MAP_FAILED)
+      base = NULL;
+#endif
+  }
+  close(fd);
+  return base;
+}
+
+bool imageSection(uint64_t size, uint64_t off, uint64_t bytes) {
+  return off <= size && bytes <= size - off;
+}
+
+// A mapped Stock is used in place, so its id and history ring must agree
+// before anything indexes with them (as windowPush leaves them)
+bool stockImageValid(const Stock *s, int id) {
+  return s->id == id && s->ticks >= 0 && !s->inBatch && !s->snapDirty &&
+         s->head == s->ticks % HISTORY_SIZE &&
+         s->count == (s->ticks < HISTORY_SIZE ? s->ticks : HISTORY_SIZE);
+}
+
+// One bit per shard structure a stock must appear in at most once
+enum {
+  SEEN_TABLE = 1,
+  SEEN_RANK = 2,
+  SEEN_MAX_HEAP = 4,
+  SEEN_MIN_HEAP = 8,
+  SEEN_OVERSOLD = 16
+};
+
+// Is 'id' a stock of 'sh' not yet met in the structure 'bit'?
+bool imageMember(Shard *sh, uint32_t id, uint8_t *seen, uint8_t bit) {
+  if (id >= (uint32_t)registryCount || (seen[id] & bit) ||
+      shardFor(symbolAt((int)id)->hash) != sh)
+    return false;
+  seen[id] |= bit;
+  return true;
+}
+
+// Height of the image subtree at 'n', or -1 unless it is an AVL tree in
+// (gain asc, id desc) order with true sizes and heights whose nodes and
+// stocks point at each other. '*prev' is the last node met in order. The
+// depth limit is RankCursor's stack, and also stops a cycle.
+int rankImageCheck(Shard *sh, const RankNode *p, int count, int n, int depth,
+                   int *prev, uint8_t *seen) {
+  if (n == 0)
+    return 0;
+  if (n < 0 || n >= count || depth >= 64)
+    return -1;
+  const RankNode *x = &p[n];
+  int hl = rankImageCheck(sh, p, count, x->left, depth + 1, prev, seen);
+  if (hl < 0 || !imageMember(sh, (uint32_t)x->stock, seen, SEEN_RANK) ||
+      stockRegistry[x->stock]->rankIdx != n)
+    return -1;
+  if (*prev && !(p[*prev].key < x->key ||
+                 (p[*prev].key == x->key && p[*prev].stock > x->stock)))
+    return -1;
+  *prev = n;
+  int hr = rankImageCheck(sh, p, count, x->right, depth + 1, prev, seen);
+  int sl = x->left ? p[x->left].size : 0, sr = x->right ? p[x->right].size : 0;
+  if (hr < 0 || hl - hr > 1 || hr - hl > 1 ||
+      x->height != 1 + (hl > hr ? hl : hr) || x->size != 1 + sl + sr)
+    return -1;
+  return x->height;
+}
+
+// Check one shard's index arrays in the image against the registered
+// stocks, so a damaged file cannot send a probe or a walk out of bounds
+bool shardImageValid(Shard *sh, const ShardImage *si, const char *base,
+                     uint8_t *seen) {
+  int size = si->heapSize;
+  if (size < 0 || size > registryCount ||
+      si->rankCount != (size ? size + 1 : 0) || si->oversoldCount < 0 ||
+      si->oversoldCount > size || si->tableSize != (uint32_t)size)
+    return false;
+  // A power-of-two table with a free slot, so every probe ends
+  if (size) {
+    uint64_t cap = (uint64_t)si->tableMask + 1;
+    if ((cap & (cap - 1)) || si->tableSize >= cap)
+      return false;
+    const HashSlot *t = (const HashSlot *)(base + si->slotsOffset);
+    uint32_t used = 0;
+    for (uint64_t j = 0; j < cap; j++) {
+      if (!t[j].hash)
+        continue;
+      if (!imageMember(sh, (uint32_t)t[j].id, seen, SEEN_TABLE) ||
+          t[j].hash != symbolAt(t[j].id)->hash)
+        return false;
+      used++;
+    }
+    if (used != si->tableSize)
+      return false;
+  }
+  const RankNode *p = (const RankNode *)(base + si->rankOffset);
+  int prev = 0;
+  if (rankImageCheck(sh, p, si->rankCount, si->rankRoot, 0, &prev, seen) < 0 ||
+      (size && p[si->rankRoot].size != size))
+    return false;
+  const uint32_t *heaps = (const uint32_t *)(base + si->heapsOffset);
+  const uint32_t *minHeap = heaps + size, *oversold = heaps + 2 * size;
+  for (int j = 0; j < size; j++) {
+    if (!imageMember(sh, heaps[j], seen, SEEN_MAX_HEAP) ||
+        !imageMember(sh, minHeap[j], seen, SEEN_MIN_HEAP))
+      return false;
+    int up = (j - 1) / HEAP_ARITY;
+    if (j && (heapAbove((HeapEntry){hot.gain[heaps[j]], (int)heaps[j]},
+                        (HeapEntry){hot.gain[heaps[up]], (int)heaps[up]}) ||
+              heapAbove((HeapEntry){-hot.gain[minHeap[j]], (int)minHeap[j]},
+                        (HeapEntry){-hot.gain[minHeap[up]], (int)minHeap[up]})))
+      return false;
+  }
+  for (int j = 0; j < si->oversoldCount; j++) {
+    if (!imageMember(sh, oversold[j], seen, SEEN_OVERSOLD) ||
+        stockRegistry[oversold[j]]->oversoldIdx != j)
+      return false;
+  }
+  return true;
+}
+
+// Can every shard's indexes be taken over as they are? Each stock must sit
+// in all of its shard's structures, and be in the oversold set exactly when
+// its oversoldIdx says so.
+bool shardImagesValid(const CheckpointHeader *h, const char *base) {
+  uint8_t *seen = (uint8_t *)calloc(registryCount ? registryCount : 1, 1);
+  bool ok = seen != NULL;
+  for (int i = 0; ok && i < shardCount; i++)
+    ok = shardImageValid(&shards[i], &h->shards[i], base, seen);
+  for (int i = 0; ok && i < registryCount; i++) {
+    uint8_t all = SEEN_TABLE | SEEN_RANK | SEEN_MAX_HEAP | SEEN_MIN_HEAP;
+    ok = (seen[i] & all) == all &&
+         (stockRegistry[i]->oversoldIdx == -1) == !(seen[i] & SEEN_OVERSOLD);
+  }
+  free(seen);
+  return ok;
+}
+
+// Take over one shard's index arrays from the image (checked by
+// shardImageValid): the single fix-up pass turns stock ids back into
+// pointers where the shard keeps pointers. Stocks are already registered.
+bool shardFromImage(Shard *sh, const ShardImage *si, const char *base) {
+  if (!reserveShard(sh, si->heapSize))
+    return false;
+  if (si->tableSize) {
+    size_t bytes = ((size_t)si->tableMask + 1) * sizeof(HashSlot);
+    HashSlot *t = (HashSlot *)malloc(bytes);
+    if (!t)
+      return false;
+    memcpy(t, base + si->slotsOffset, bytes);
+    sh->table = (HashTable){t, si->tableMask, si->tableSize};
+  }
+  memcpy(sh->rankPool, base + si->rankOffset,
+         (size_t)si->rankCount * sizeof(RankNode));
+  sh->rankCount = si->rankCount;
+  sh->rankRoot = si->rankRoot;
+  const uint32_t *heaps = (const uint32_t *)(base + si->heapsOffset);
+  for (int j = 0; j < si->heapSize; j++) {
+    // Keys come from the gain column, loaded before the shards
+    uint32_t mx = heaps[j], mn = heaps[si->heapSize + j];
+    sh->maxHeap[j] = (HeapEntry){hot.gain[mx], (int)mx};
+    hot.maxHeapIdx[mx] = j;
+    sh->minHeap[j] = (HeapEntry){-hot.gain[mn], (int)mn};
+    hot.minHeapIdx[mn] = j;
+  }
+  sh->heapSize = si->heapSize;
+  // The stocks' oversoldIdx already point into this order
+  const uint32_t *oversold = heaps + 2 * si->heapSize;
+  for (int j = 0; j < si->oversoldCount; j++)
+    sh->oversold.members[j] = stockRegistry[oversold[j]];
+  sh->oversold.count = si->oversoldCount;
+  return true;
+}
+
+// Map 'checkpoint' if there is one; returns the stocks restored, or -1.
+// With the shard count the image was written with, and indexes that check
+// out, those are taken over as they are; otherwise the mapped stocks are
+// re-indexed one by one. A damaged Stock record fails the load.
+int checkpointLoad() {
+  char path[DATA_PATH_LEN];
+  dataPath(path, "checkpoint", 0);
+  if (access(path, F_OK) != 0)
+    return 0; // Fresh data directory
+  uint64_t size = 0;
+  char *base = imageMap(path, &size);
+  if (!base)
+    return -1;
+  imageBase = base;
+  imageBytes = size;
+  CheckpointHeader *h = (CheckpointHeader *)base;
+  bool ok =
+      size >= sizeof(*h) && memcmp(h->magic, "DSA2IMG", 8) == 0 &&
+      h->format == CHECKPOINT_FORMAT && h->stockSize == sizeof(Stock) &&
+      h->priceScale == PRICE_SCALE &&
+      h->indicatorCount >= 1 && h->indicatorCount <= MAX_INDICATORS &&
+      h->shardCount >= 1 && h->shardCount <= MAX_SHARDS &&
+      h->stockCount <= INT32_MAX &&
+      imageSection(size, h->symbolsOffset,
+                   (uint64_t)h->stockCount * sizeof(Symbol)) &&
+      imageSection(size, h->stocksOffset,
+                   (uint64_t)h->stockCount * sizeof(Stock)) &&
+      imageSection(size, h->hotOffset,
+                   (uint64_t)h->stockCount * HOT_IMAGE_BYTES) &&
+      imageSection(size, h->transactionsOffset,
+                   (uint64_t)h->transactionCount * sizeof(Transaction));
+  bool sameShards = ok && h->shardCount == (uint32_t)shardCount;
+  for (uint32_t i = 0; sameShards && i < h->shardCount; i++) {
+    ShardImage *si = &h->shards[i];
+    sameShards = imageSection(size, si->slotsOffset,
+                              si->tableSize ? ((uint64_t)si->tableMask + 1) *
+                                                  sizeof(HashSlot)
+                                            : 0) &&
+                 imageSection(size, si->rankOffset,
+                              (uint64_t)si->rankCount * sizeof(RankNode)) &&
+                 imageSection(size, si->heapsOffset,
+                              ((uint64_t)si->heapSize * 2 + si->oversoldCount) *
+                                  sizeof(uint32_t));
+  }
+  if (!ok || !reserveStocks((int)h->stockCount))
+    return -1;
+
+  indicatorCount = (int)h->indicatorCount;
+  memcpy(indicatorSpecs, h->indicators, sizeof(indicatorSpecs));
+  Stock *stocks = (Stock *)(base + h->stocksOffset);
+  // Names and hot columns are copied: they must stay growable
+  const Symbol *symbols = (const Symbol *)(base + h->symbolsOffset);
+  for (uint32_t i = 0; i < h->stockCount; i++) {
+    Symbol *sym = symbolAt((int)i);
+    *sym = symbols[i];
+    sym->name[NAME_LEN - 1] = '\0';
+  }
+  size_t column = (size_t)h->stockCount * 4; // Bytes of a 4-byte column
+  const char *cols = base + h->hotOffset;
+  memcpy(hot.price, cols, 2 * column);
+  memcpy(hot.buy, cols + 2 * column, 2 * column);
+  memcpy(hot.gain, cols + 4 * column, column);
+  memcpy(hot.quantity, cols + 5 * column, column);
+  for (uint32_t i = 0; ok && i < h->stockCount; i++)
+    ok = stockImageValid(&stocks[i], (int)i);
+  if (!ok)
+    return -1;
+  if (sameShards) {
+    for (uint32_t i = 0; i < h->stockCount; i++)
+      stockRegistry[i] = &stocks[i];
+    registryCount = (int)h->stockCount;
+    // Damaged indexes are rebuilt from the stocks, as for a new shard count
+    sameShards = shardImagesValid(h, base);
+    if (!sameShards) {
+      fprintf(stderr, "Checkpoint indexes are damaged; re-indexing\n");
+      registryCount = 0;
+    }
+  }
+  if (sameShards) {
+    for (int i = 0; ok && i < shardCount; i++)
+      ok = shardFromImage(&shards[i], &h->shards[i], base);
+  } else {
+    for (uint32_t i = 0; ok && i < h->stockCount; i++) {
+      Stock *s = &stocks[i];
+      uint32_t hash = symbolAt((int)i)->hash;
+      Shard *sh = shardFor(hash);
+      ok = reserveShard(sh, sh->heapSize + 1);
+      if (ok)
+        linkStock(sh, hash, s);
+    }
+  }
+  // The snapshot tree picks the mapped stocks up on its next publish
+  snapUnpublished = registryCount;
+
+  Transaction *t = (Transaction *)(base + h->transactionsOffset);
+  for (uint32_t i = 0; ok && i < h->transactionCount; i++, t++) {
+    ok = t->stock >= 0 && (uint32_t)t->stock < h->stockCount &&
+         t->type < TX_TYPES;
+    if (ok)
+      logTransaction(shardFor(symbolAt(t->stock)->hash), (TxType)t->type,
+                     t->stock, t->price, t->seq);
+  }
+  transSeq = h->transSeq;
+  checkpointGen = walGen = h->walGen;
+  return ok ? (int)h->stockCount : -1;
+}
+
+// Re-apply one log file. Returns the length up to the last complete
+// command (a crash can tear the tail, or cut a batch short), or -1 if the
+// file does not exist.
+long walReplay(const char *path, unsigned long *records) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  WalRecord r;
+  long pos = 0, complete = 0;
+  while (fread(&r, sizeof(r), 1, f) == 1 && r.check == walChecksum(&r)) {
+    r.name[NAME_LEN - 1] = '\0';
+    pos += sizeof(r);
+    (*records)++;
+    if (r.type == WAL_TICK) {
+      batchQueue(r.name, r.price, r.value);
+      continue; // Not a command boundary
+    }
+    if (r.type == WAL_ADD)
+      addStock(r.name, r.price, r.value);
+    else if (r.type == WAL_UPDATE)
+      updateStockPrice(r.name, r.price, r.value, true);
+    else if (r.type == WAL_APPLY)
+      batchApply();
+    else if (r.type == WAL_INDICATOR)
+      registerIndicator(strcmp(r.name, "SMA") == 0 ? IND_SMA : IND_RSI,
+                        r.value);
+    else if (r.type == WAL_RESET)
+      engineReset();
+    complete = pos;
+  }
+  fclose(f);
+  // Ticks of a batch cut short were never acknowledged
+  for (int i = 0; i < shardCount; i++)
+    shards[i].workCount = 0;
+  return complete;
+}
+
+// Recover from --data-dir and start logging; false if that is impossible
+bool persistStart() {
+  double start = nowNs();
+  makeDataDir();
+  int stocks = checkpointLoad();
+  if (stocks < 0) {
+    fprintf(stderr, "Cannot load the checkpoint in %s\n", dataDir);
+    return false;
+  }
+
+  // A checkpoint child that outlived a crashed engine leaves the logs it
+  // covers behind
+  char path[DATA_PATH_LEN], next[DATA_PATH_LEN];
+  for (unsigned long g = walGen - 1; g > 0; g--) {
+    dataPath(path, "wal", g);
+    if (remove(path) != 0)
+      break;
+  }
+
+  // Normally one log follows the checkpoint; a crash between switching
+  // logs and finishing the checkpoint leaves two
+  unsigned long records = 0;
+  dataPath(path, "wal", walGen);
+  long valid = walReplay(path, &records);
+  for (;;) {
+    dataPath(next, "wal", walGen + 1);
+    long v = walReplay(next, &records);
+    if (v < 0)
+      break;
+    walGen++;
+    valid = v;
+    strcpy(path, next);
+  }
+
+  // Continue the newest log right after its last complete command
+  walFd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, 0644);
+  checkpointLast = nowNs();
+  if (walFd < 0 || (valid >= 0 && ftruncate(walFd, valid) != 0)) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  syncDataDir();
+  walSinceCheckpoint = records;
+  if (pthread_create(&walThread, NULL, walFlusher, NULL) != 0) {
+    fprintf(stderr, "Cannot start the WAL flusher\n");
+    return false;
+  }
+  walEnabled = true;
+  fprintf(stderr,
+          "Recovered %d stocks from the checkpoint and %lu log records in "
+          "%.1f ms\n",
+          stocks, records, (nowNs() - start) / 1e6);
+  return true;
+}
+
+void persistStop() {
+  if (!walEnabled)
+    return;
+  walEnabled = false;
+  pthread_mutex_lock(&walLock);
+  walStop = true;
+  pthread_cond_signal(&walWork);
+  pthread_mutex_unlock(&walLock);
+  pthread_join(walThread, NULL);
+  close(walFd);
+  walFd = -1;
+}
+
+void printWalStats() {
+  if (!walEnabled)
+    return;
+  pthread_mutex_lock(&walLock);
+  unsigned long syncs = walSyncs;
+  pthread_mutex_unlock(&walLock);
+  outf(", \"wal\": {\"gen\": %lu, \"bytes\": %lu, \"durable\": %lu, "
+       "\"groupCommits\": %lu, \"checkpoints\": %lu, \"checkpointMs\": %.1f, "
+       "\"broken\": %s}",
+       walGen, walSubmitted, atomic_load(&walDurable), syncs, checkpoints,
+       checkpointMs, atomic_load(&walBroken) ? "true" : "false");
+
+  // written/total track the running child; forkMs is the engine's stall
+  bool running = checkpointPoll(false);
+  outf(", \"checkpoint\": {\"running\": %s, \"written\": %lu, "
+       "\"total\": %lu, \"forkMs\": %.2f, \"lastMs\": %.1f, "
+       "\"completed\": %lu, \"failed\": %lu}",
+       running ? "true" : "false",
+       ckptProgress ? atomic_load(&ckptProgress->written) : 0,
+       ckptProgress ? atomic_load(&ckptProgress->total) : 0, checkpointForkMs,
+       checkpointMs, checkpoints, checkpointsFailed);
+}
+
+// CHECKPOINT: start a background checkpoint now
+void cmdCheckpoint() {
+  if (!walEnabled)
+    outf("{\"error\": \"Persistence is off (start with --data-dir)\"}\n");
+  else if (checkpointPoll(false))
+    outf("{\"error\": \"A checkpoint is already running\"}\n");
+  else if (checkpointStart())
+    outf("{\"status\": \"ok\", \"message\": \"Checkpoint started\", "
+         "\"gen\": %lu}\n",
+         walGen);
+  else
+    outf("{\"error\": \"Cannot start a checkpoint\"}\n");
+}
+
+// With --data-dir: UPDATE latency while idle, while a forked child writes
+// a checkpoint, and the stall a checkpoint on the engine thread would be
+void benchCheckpoint(uint32_t *rng) {
+  if (!dataDir)
+    return;
+  double *ns = (double *)malloc(BENCH_LATENCY_SAMPLES * sizeof(double));
+  if (!ns)
+    return;
+  makeDataDir();
+  printf("\nUPDATE latency (ns) around a checkpoint of %d symbols\n",
+         registryCount);
+  printf("%-12s | %8s | %8s | %8s | %8s | %10s\n", "PHASE", "UPDATES", "p50",
+         "p99", "p99.9", "max");
+  printf("-----------------------------------------------------------------"
+         "---\n");
+  benchLatencyLine("idle", ns,
+                   benchTimedUpdates(rng, ns, BENCH_LATENCY_SAMPLES, false));
+  if (!checkpointStart()) {
+    printf("Cannot start a checkpoint in %s\n", dataDir);
+    free(ns);
+    return;
+  }
+  int n = benchTimedUpdates(rng, ns, BENCH_LATENCY_SAMPLES, true);
+  benchLatencyLine("checkpoint", ns, n);
+  checkpointPoll(true);
+  double childMs = checkpointMs;
+  checkpoint();
+  printf("fork: %.2f ms, child: %.1f ms, on the engine thread: %.1f ms\n",
+         checkpointForkMs, childMs, checkpointMs);
+  free(ns);
+}
+
+/* ================= PIPELINE ================= */
+// reader thread -> ingestRing -> engine (this thread) -> responseRing ->
+// writer thread. Parsing, execution and output overlap, and a slow consumer
+// of stdout only stalls the engine once responseRing is full.
+// Snapshot reads (STOCKS, SUMMARY, TOP) detour through a query thread and
+// are rendered there while the engine moves on to the next command.
+
+#define OUT_RECYCLE_MAX (1u << 20) // Larger response buffers are freed
+#define QUERY_RING_SLOTS (2 * RESPONSE_RING_SLOTS) // Never fills: see below
+
+// Snapshot read handed to a query thread (snap == NULL stops the thread)
+typedef struct Query {
+  QueryKind kind; // Text form
+  bool binary;
+  uint8_t op; // Binary form
+  bool tagged;
+  unsigned long id;
+  Snapshot *snap; // Pinned by the engine, unpinned once rendered
+} Query;
+
+// A query's result is only waited for once its placeholder has passed
+// through responseRing, so each thread has at most RESPONSE_RING_SLOTS + 2
+// queries or results outstanding and its rings can never fill up.
+SpscRing queryRing[QUERY_THREADS];     // Engine -> query thread: Query
+SpscRing queryDoneRing[QUERY_THREADS]; // Query thread -> writer: OutBuf
+int nextQueryThread = 0;
+
+// Query stage: render snapshot reads while the engine keeps applying ticks
+void *queryWorker(void *arg) {
+  int self = (int)(intptr_t)arg;
+  Query q;
+  for (;;) {
+    ringPop(&queryRing[self], &q);
+    if (!q.snap)
+      break;
+    if (q.binary) {
+      frameRequestId = (uint32_t)q.id;
+      snapFrame(q.op, q.snap);
+      frameEnd();
+    } else {
+      // The tag reports the version: "#<id>@<version> <json>"
+      if (q.tagged)
+        outf("#%lu@%lu ", q.id, q.snap->version);
+      execTextQuery(q.kind, q.snap);
+    }
+    atomic_fetch_sub(&q.snap->pins, 1);
+    ringPush(&queryDoneRing[self], &out); // The writer owns it now
+    out = (OutBuf){0};
+  }
+  return NULL;
+}
+
+// Hand a snapshot read to the next query thread. False if the record is
+// not one (or no snapshot could be published), so the engine runs it.
+bool dispatchQuery(CmdRecord *rec) {
+  Query q = {0};
+  if (rec->kind == REC_TEXT) {
+    char cmd[50] = "";
+    sscanf(rec->line, "%49s", cmd);
+    q.kind = textQueryKind(cmd);
+    if (q.kind == QUERY_NONE)
+      return false;
+  } else if (rec->kind == REC_FRAME &&
+             (rec->op == OP_STOCKS || rec->op == OP_SUMMARY ||
+              rec->op == OP_TOP)) {
+    q.binary = true;
+    q.op = rec->op;
+  } else {
+    return false;
+  }
+  q.snap = snapPublish();
+  if (!q.snap)
+    return false;
+  q.tagged = rec->tagged;
+  q.id = rec->id;
+  atomic_fetch_add(&q.snap->pins, 1);
+
+  Response r = {{0}, true, nextQueryThread, 0};
+  ringPush(&queryRing[nextQueryThread], &q);
+  ringPush(&responseRing, &r);
+  nextQueryThread = (nextQueryThread + 1) % QUERY_THREADS;
+  return true;
+}
+
+// Writer stage: flush once caught up, so back-to-back responses share a
+// single write() instead of one per response
+void *responseWriter(void *arg) {
+  (void)arg;
+  Response r;
+  for (;;) {
+    ringPop(&responseRing, &r);
+    if (r.deferred)
+      ringPop(&queryDoneRing[r.worker], &r.buf);
+    else if (!r.buf.data)
+      break; // Engine finished
+    if (atomic_load(&walDurable) < r.walLsn) {
+      fflush(stdout); // Do not hold earlier responses during the sync
+      walWaitDurable(r.walLsn);
+    }
+    if (r.buf.data)
+      fwrite(r.buf.data, 1, r.buf.len, stdout);
+    if (ringDepth(&responseRing) == 0)
+      fflush(stdout); // CRITICAL: Ensure Node.js receives the packet now
+    if (r.buf.cap > OUT_RECYCLE_MAX || !ringTryPush(&freeRing, &r.buf))
+      free(r.buf.data);
+  }
+  fflush(stdout);
+  return NULL;
+}
+
+// Engine stage: apply records in arrival order
+void engineLoop() {
+  CmdRecord rec;
+  for (;;) {
+    ringPop(&ingestRing, &rec);
+    if (rec.kind == REC_END)
+      break;
+    if (dispatchQuery(&rec))
+      continue;
+    if (rec.kind == REC_TEXT) {
+      if (rec.tagged)
+        outf("#%lu ", rec.id);
+      execTextCommand(rec.line);
+    } else if (rec.kind == REC_FRAME) {
+      frameRequestId = (uint32_t)rec.id;
+      execBinaryFrame(&rec);
+      frameEnd();
     } else {
-      printf("{\"error\": \"Unknown command\"}\n");
+      continue; // Ticks are always consumed by their batch header
     }
+    outFlush();
+    if (walEnabled)
+      checkpointTick();
+  }
+}
 
-    fflush(stdout); // CRITICAL: Ensure Node.js receives the packet immediately
+int runPipeline(void *(*reader)(void *)) {
+  if (dataDir && !persistStart())
+    return 1;
+  pthread_t readerThread, writerThread, queryThreads[QUERY_THREADS];
+  bool ok = ringInit(&ingestRing, INGEST_RING_SLOTS, sizeof(CmdRecord)) &&
+            ringInit(&responseRing, RESPONSE_RING_SLOTS, sizeof(Response)) &&
+            ringInit(&freeRing, RESPONSE_RING_SLOTS, sizeof(OutBuf));
+  for (int i = 0; ok && i < QUERY_THREADS; i++)
+    ok = ringInit(&queryRing[i], QUERY_RING_SLOTS, sizeof(Query)) &&
+         ringInit(&queryDoneRing[i], QUERY_RING_SLOTS, sizeof(OutBuf)) &&
+         pthread_create(&queryThreads[i], NULL, queryWorker,
+                        (void *)(intptr_t)i) == 0;
+  if (!ok || pthread_create(&readerThread, NULL, reader, NULL) != 0 ||
+      pthread_create(&writerThread, NULL, responseWriter, NULL) != 0) {
+    fprintf(stderr, "Cannot start the API pipeline\n");
+    return 1;
   }
+
+  engineLoop();
+  if (walEnabled) {
+    checkpointPoll(true); // Reap a background checkpoint still running
+    if (walSinceCheckpoint > 0)
+      checkpoint(); // A clean shutdown restarts without any replay
+  }
+
+  Query stop = {0};
+  for (int i = 0; i < QUERY_THREADS; i++)
+    ringPush(&queryRing[i], &stop);
+  Response done = {{0}, false, 0, 0};
+  ringPush(&responseRing, &done);
+  pthread_join(writerThread, NULL);
+  for (int i = 0; i < QUERY_THREADS; i++)
+    pthread_join(queryThreads[i], NULL);
+  pthread_join(readerThread, NULL);
+  persistStop();
+  return 0;
 }
 
 /* ================= MAIN ================= */
 
+// "--log-retain=" value: a transaction count, or a byte budget with a
+// B/KB/MB/GB suffix (e.g. 64MB)
+unsigned long parseRetention(const char *arg) {
+  char *end;
+  unsigned long n = strtoul(arg, &end, 10);
+  unsigned long scale = 0;
+  if (strcmp(end, "B") == 0)
+    scale = 1;
+  else if (strcmp(end, "KB") == 0)
+    scale = 1UL << 10;
+  else if (strcmp(end, "MB") == 0)
+    scale = 1UL << 20;
+  else if (strcmp(end, "GB") == 0)
+    scale = 1UL << 30;
+  return scale ? n * scale / sizeof(Transaction) : n;
+}
+
 int main(int argc, char *argv[]) {
+  // Engine options may accompany any mode; strip them before the mode
+  // checks
+  int nShards = 1;
+  unsigned long logRetain = LOG_RETAIN_DEFAULT;
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--shards=", 9) == 0)
+      nShards = atoi(argv[i] + 9);
+    else if (strncmp(argv[i], "--log-retain=", 13) == 0)
+      logRetain = parseRetention(argv[i] + 13);
+    else if (strncmp(argv[i], "--data-dir=", 11) == 0)
+      dataDir = argv[i] + 11;
+    else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0)
+      checkpointEvery = strtoul(argv[i] + 19, NULL, 10);
+    else if (strncmp(argv[i], "--checkpoint-interval=", 22) == 0)
+      checkpointInterval = atof(argv[i] + 22);
+    else
+      argv[kept++] = argv[i];
+  }
+  argc = kept;
+  if (dataDir && strlen(dataDir) > DATA_PATH_LEN - 32) {
+    fprintf(stderr, "--data-dir path is too long\n");
+    return 1;
+  }
+  // The self-test starts its own engines, one per shard count
+  if (argc > 1 && strcmp(argv[1], "--selftest") == 0)
+    return runSelfTest(nShards, logRetain);
+  startShards(nShards, logRetain);
+
   // Check for API mode flag
-  if (argc > 1 && strcmp(argv[1], "--api") == 0) {
-    runApiMode();
+  if (argc > 1 && (strcmp(argv[1], "--api") == 0 ||
+                   strcmp(argv[1], "--api=text") == 0)) {
+    return runApiMode();
+  }
+  if (argc > 1 && strcmp(argv[1], "--api=binary") == 0) {
+    return runBinaryApiMode();
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    runBenchmark(argc > 2 ? atoi(argv[2]) : 1000000);
     return 0;
   }
 
   // Default Interactive Mode
   int choice;
   char name[20];
-  float p;
+  char priceText[32];
+  int64_t p;
   int q;
+  Status st;
 
   while (1) {
     printf("\n1. Add Stock\n2. Update Price\n3. Show Analysis\n4. Show Sorted "
-           "(AVL)\n5. Top Gainer/Loser\n6. Run Auto-Test (Hardcoded)\n7. "
+           "(By Gain)\n5. Top Gainer/Loser\n6. Run Auto-Test (Hardcoded)\n7. "
            "Exit\n> ");
     if (scanf("%d", &choice) != 1) {
       while (getchar() != '\n')
@@ -880,34 +5397,43 @@ int main(int argc, char *argv[]) {
       printf("Name: ");
       scanf("%19s", name);
       printf("Price: ");
-      scanf("%f", &p);
+      scanf("%31s", priceText);
       printf("Qty: ");
       scanf("%d", &q);
-      addStock(name, p, q);
+      if (!priceParse(priceText, &p)) {
+        printf("Error: Invalid price.\n");
+        break;
+      }
+      st = addStock(name, p, q);
+      if (st != ST_OK)
+        printf("Error: %s.\n", statusMessage(st));
       break;
     case 2:
       printf("\n--- UPDATE STOCK ---\n");
       printf("%-15s: ", "Name");
       scanf("%19s", name);
       printf("%-15s: ", "New Price");
-      scanf("%f", &p);
+      scanf("%31s", priceText);
       printf("%-15s: ", "New Quantity");
       scanf("%d", &q);
-      updateStockPrice(name, p, q, false);
+      if (!priceParse(priceText, &p))
+        printf("Error: Invalid price.\n");
+      else if (updateStockPrice(name, p, q, false) != ST_OK)
+        printf("Stock not found.\n");
       break;
     case 3:
       analyzeIndicators();
       break;
     case 4:
-      printf("\nSorted by Gain (AVL In-Order):\n");
-      inOrderAVL(avlRoot);
+      printf("\nSorted by Gain (Order-Statistic Tree, Descending):\n");
+      rankWalk(true, registryCount, printRankLine, NULL);
       break;
     case 5:
-      if (heapSize > 0) {
-        printf("Top Gainer: %s (%.2f%%)\n", maxHeap[0]->name,
-               getPercent(maxHeap[0]));
-        printf("Top Loser:  %s (%.2f%%)\n", minHeap[0]->name,
-               getPercent(minHeap[0]));
+      if (registryCount > 0) {
+        printf("Top Gainer: %s (%.2f%%)\n", symbolName(topGainer()->id),
+               getPercent(topGainer()));
+        printf("Top Loser:  %s (%.2f%%)\n", symbolName(topLoser()->id),
+               getPercent(topLoser()));
       } else
         printf("No stocks.\n");
       break;
@@ -7,20 +7,32 @@ interface Cluster {
     members: string[];
 }
 
+interface CorrelationEdge {
+    a: string;
+    b: string;
+    corr: number;
+}
+
 export default function CorrelationGraph() {
     const [clusters, setClusters] = useState<Cluster[]>([]);
+    const [edges, setEdges] = useState<CorrelationEdge[]>([]);
     const [loading, setLoading] = useState(true);
 
     const fetchClusters = async () => {
         try {
-            const res = await fetch('http://localhost:5000/api/clusters');
-            const data = await res.json();
+            const [clustersRes, edgesRes] = await Promise.all([
+                fetch('http://localhost:5000/api/clusters'),
+                fetch('http://localhost:5000/api/correlations?threshold=0.8&limit=12')
+            ]);
+            const data = await clustersRes.json();
+            const graph = await edgesRes.json();
             // Ensure data is array
             if (Array.isArray(data)) {
                 setClusters(data);
             } else {
                 setClusters([]);
             }
+            setEdges(Array.isArray(graph.edges) ? graph.edges : []);
         } catch (error) {
             console.error("Failed to fetch clusters", error);
         } finally {
@@ -34,7 +46,7 @@ export default function CorrelationGraph() {
         return () => clearInterval(interval);
     }, []);
 
-    if (clusters.length === 0 && !loading) return null;
+    if (clusters.length === 0 && edges.length === 0 && !loading) return null;
 
     return (
         <Card className="border-t-4 border-t-yellow-500 mb-8">
@@ -70,6 +82,20 @@ export default function CorrelationGraph() {
                     ))}
                 </div>
             )}
+
+            {edges.length > 0 && (
+                <div className="mt-6">
+                    <h4 className="font-semibold text-gray-300 mb-2">Strongest Return Correlations (|r| ≥ 0.8, last 100 ticks)</h4>
+                    <div className="grid grid-cols-1 md:grid-cols-2 lg:grid-cols-3 gap-2">
+                        {edges.map(edge => (
+                            <div key={`${edge.a}-${edge.b}`} className="flex justify-between px-3 py-2 bg-white/5 rounded-lg text-sm">
+                                <span className="text-gray-200">{edge.a} ↔ {edge.b}</span>
+                                <span className={edge.corr >= 0 ? 'text-emerald-400' : 'text-red-400'}>{edge.corr.toFixed(2)}</span>
+                            </div>
+                        ))}
+                    </div>
+                </div>
+            )}
         </Card>
     );
 }
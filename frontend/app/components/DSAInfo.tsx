@@ -34,8 +34,8 @@ export default function DSAInfo() {
                 <div className="flex items-start gap-3 p-3 rounded-xl bg-white/5 hover:bg-white/10 transition-colors">
                     <Activity className="w-6 h-6 text-emerald-400 mt-1" />
                     <div>
-                        <h4 className="font-semibold text-emerald-200">Circular Queue + BIT</h4>
-                        <p className="text-xs text-gray-400 mt-1">Ring buffer for price history effeciently coupled with Fenwick Trees for O(log N) indicator calculations.</p>
+                        <h4 className="font-semibold text-emerald-200">Circular Queue + Prefix Sums</h4>
+                        <p className="text-xs text-gray-400 mt-1">Ring buffer for price history with running window sums, giving O(1) SMA/RSI for any period.</p>
                     </div>
                 </div>
             </div>
@@ -22,12 +22,13 @@ export default function StockDashboard() {
     const [updateName, setUpdateName] = useState('');
     const [updatePrice, setUpdatePrice] = useState('');
     const [updateQty, setUpdateQty] = useState('');
+    const [suggestions, setSuggestions] = useState<Pick<Stock, 'name' | 'currentPrice'>[]>([]);
 
     const fetchData = async () => {
         setLoading(true);
         try {
             const [stocksRes, summaryRes, topRes] = await Promise.all([
-                fetch('http://localhost:5000/api/stocks'),
+                fetch('http://localhost:5000/api/sorted'),
                 fetch('http://localhost:5000/api/summary'),
                 fetch('http://localhost:5000/api/top')
             ]);
@@ -64,6 +65,16 @@ export default function StockDashboard() {
         fetchData();
     };
 
+    // Autocomplete the symbol box from the engine's prefix trie
+    const handleUpdateName = async (value: string) => {
+        setUpdateName(value);
+        const q = value.trim().toUpperCase();
+        if (!q) return setSuggestions([]);
+        const res = await fetch(`http://localhost:5000/api/search?q=${encodeURIComponent(q)}&limit=8`);
+        const data = await res.json();
+        setSuggestions(Array.isArray(data) ? data : []);
+    };
+
     const handleUpdatePrice = async (e: React.FormEvent) => {
         e.preventDefault();
         await fetch('http://localhost:5000/api/price', {
@@ -166,7 +177,10 @@ export default function StockDashboard() {
                     <Card>
                         <CardHeader title="Quick Update" subtitle="Update stock price efficiently" />
                         <form onSubmit={handleUpdatePrice} className="space-y-3">
-                            <input className="input-field" placeholder="Stock Symbol" value={updateName} onChange={e => setUpdateName(e.target.value)} required />
+                            <input className="input-field" placeholder="Stock Symbol" list="symbol-suggestions" value={updateName} onChange={e => handleUpdateName(e.target.value)} required />
+                            <datalist id="symbol-suggestions">
+                                {suggestions.map(s => <option key={s.name} value={s.name}>₹{s.currentPrice}</option>)}
+                            </datalist>
                             <div className="grid grid-cols-2 gap-2">
                                 <input className="input-field" type="number" step="0.01" placeholder="New Price" value={updatePrice} onChange={e => setUpdatePrice(e.target.value)} required />
                                 <input className="input-field" type="number" placeholder="New Qty" value={updateQty} onChange={e => setUpdateQty(e.target.value)} />
@@ -179,7 +193,7 @@ export default function StockDashboard() {
                 {/* STOCK LIST */}
                 <div className="lg:col-span-2">
                     <Card className="h-full">
-                        <CardHeader title="Market Overview" subtitle="Real-time sorted view (AVL Tree)" />
+                        <CardHeader title="Market Overview" subtitle="Ranked by gain (Order-Statistic Tree)" />
                         <div className="overflow-x-auto">
                             <table className="w-full text-left border-collapse">
                                 <thead>